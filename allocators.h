@@ -0,0 +1,253 @@
+#pragma once
+
+#include "atomic.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace NLFHT
+{
+    // Memory providers for table entries.
+    // Each provider is a tag class with two static functions:
+    //   Allocate(bytes)         - returns zero-filled memory aligned at least to cache line
+    //   Deallocate(ptr, bytes)  - frees memory, bytes are the same as in Allocate
+
+    // Heap memory for small regions and anonymous mmap for big ones:
+    // fresh mapping is zero-filled by kernel page by page on first touch,
+    // so big region is not written before use.
+    class AlignedMemory
+    {
+    public:
+        static const size_t MMAP_THRESHOLD = 1 << 20;
+
+        static void* Allocate(size_t bytes)
+        {
+            void* result;
+            if (bytes >= MMAP_THRESHOLD)
+            {
+                result = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (result == MAP_FAILED)
+                    throw std::bad_alloc();
+                return result;
+            }
+            if (posix_memalign(&result, CACHE_LINE_SIZE, bytes))
+                throw std::bad_alloc();
+            memset(result, 0, bytes);
+            return result;
+        }
+
+        static void Deallocate(void* ptr, size_t bytes)
+        {
+            if (bytes >= MMAP_THRESHOLD)
+                munmap(ptr, bytes);
+            else
+                free(ptr);
+        }
+    };
+
+    // Anonymous mmap backed by huge pages.
+    // Explicit huge pages (MAP_HUGETLB) are tried first, if none are reserved
+    // in system, transparent huge pages are requested with MADV_HUGEPAGE.
+    // With Populate all pages are faulted in by Allocate, so the first pass
+    // over new table does not page fault.
+    // Regions smaller than huge page are taken from heap.
+    template <bool Populate = false>
+    class HugePageMemory
+    {
+    public:
+        static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+        static void* Allocate(size_t bytes)
+        {
+            if (bytes < HUGE_PAGE_SIZE)
+                return AlignedMemory::Allocate(bytes);
+
+            const size_t length = RoundUp(bytes);
+            const int populate = Populate ? MAP_POPULATE : 0;
+            void* result = MAP_FAILED;
+#ifdef MAP_HUGETLB
+            result = mmap(0, length, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | populate, -1, 0);
+#endif
+            if (result == MAP_FAILED)
+            {
+                result = mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (result == MAP_FAILED)
+                    throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+                // not an error if THP are disabled
+                madvise(result, length, MADV_HUGEPAGE);
+#endif
+                // populate after madvise, otherwise region is faulted with small pages
+                if (Populate)
+                    Prefault((char*)result, length);
+            }
+            return result;
+        }
+
+        static void Deallocate(void* ptr, size_t bytes)
+        {
+            if (bytes < HUGE_PAGE_SIZE)
+                AlignedMemory::Deallocate(ptr, bytes);
+            else
+                munmap(ptr, RoundUp(bytes));
+        }
+
+    private:
+        static size_t RoundUp(size_t bytes)
+        {
+            return (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        }
+
+        static void Prefault(char* ptr, size_t length)
+        {
+#ifdef MADV_POPULATE_WRITE
+            if (!madvise(ptr, length, MADV_POPULATE_WRITE))
+                return;
+#endif
+            const size_t pageSize = sysconf(_SC_PAGESIZE);
+            for (size_t offset = 0; offset < length; offset += pageSize)
+                ((volatile char*)ptr)[offset] = 0;
+        }
+    };
+
+    // Memory shared by processes, which are forked after Reserve: one
+    // MAP_SHARED region, mapped at the same address in all of them, so pointers
+    // of tables and guards are valid everywhere. Table object itself is placed
+    // there by its creator (see time_map_shared in time_hash_map.cpp), threads
+    // are registered after fork. Migration workers can't be woken from other
+    // processes, operations copy old tables by themselves.
+    // Blocks are rounded up to size classes, four per power of two, and freed
+    // blocks are kept in free list of their class, so tables of the same size
+    // reuse address range of thrown away ones. Pages of freed big block are
+    // given back to system at once.
+    class SharedMemory
+    {
+    public:
+        // NOT thread-safe, before fork: reserves address space,
+        // pages are taken on first touch
+        static void Reserve(size_t bytes)
+        {
+            void* result = mmap(0, bytes, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (result == MAP_FAILED)
+                throw std::bad_alloc();
+            Region* region = new (result) Region;
+            region->m_Used = RoundUp(sizeof(Region), CACHE_LINE_SIZE);
+            region->m_Size = bytes;
+            Instance() = region;
+        }
+
+        static void* Allocate(size_t bytes)
+        {
+            Region* region = Instance();
+            if (!region)
+                throw std::bad_alloc();
+            const size_t sizeClass = SizeClass(bytes);
+            bytes = ClassBytes(sizeClass);
+            // big blocks are page aligned, so Deallocate frees their pages only
+            const size_t alignment = bytes >= PageSize() ? PageSize() : CACHE_LINE_SIZE;
+
+            // lock is held for a few instructions, process is not killed with it
+            // unless it's killed in the middle of Allocate or Deallocate
+            region->m_Lock.Acquire();
+            size_t offset = region->m_Free[sizeClass];
+            if (offset)
+            {
+                region->m_Free[sizeClass] = *(size_t*)((char*)region + offset);
+                region->m_Lock.Release();
+                // the rest of big block is zero since Deallocate
+                memset((char*)region + offset, 0, bytes >= PageSize() ? sizeof(size_t) : bytes);
+                return (char*)region + offset;
+            }
+            offset = RoundUp(region->m_Used, alignment);
+            const bool fits = offset + bytes <= region->m_Size;
+            if (fits)
+                region->m_Used = offset + bytes;
+            region->m_Lock.Release();
+            if (!fits)
+                throw std::bad_alloc();
+            return (char*)region + offset;
+        }
+
+        static void Deallocate(void* ptr, size_t bytes)
+        {
+            Region* region = Instance();
+            const size_t sizeClass = SizeClass(bytes);
+            bytes = ClassBytes(sizeClass);
+            if (bytes >= PageSize())
+                madvise(ptr, bytes, MADV_REMOVE);
+            region->m_Lock.Acquire();
+            *(size_t*)ptr = region->m_Free[sizeClass];
+            region->m_Free[sizeClass] = (char*)ptr - (char*)region;
+            region->m_Lock.Release();
+        }
+
+        // bytes of region taken so far, including freed ones
+        static size_t UsedBytes()
+        {
+            return Instance() ? Instance()->m_Used : 0;
+        }
+
+    private:
+        // class c holds blocks of (4 + c % 4) << (c / 4 - 2) bytes
+        static const size_t CLASS_CNT = 64 * 4;
+
+        struct Region
+        {
+            SpinLock m_Lock;
+            volatile size_t m_Used;
+            size_t m_Size;
+            // offsets of first free blocks of classes, 0 if there is none
+            size_t m_Free[CLASS_CNT];
+        };
+
+        static Region*& Instance()
+        {
+            static Region* region = 0;
+            return region;
+        }
+
+        static size_t PageSize()
+        {
+            static const size_t pageSize = sysconf(_SC_PAGESIZE);
+            return pageSize;
+        }
+
+        static size_t RoundUp(size_t bytes, size_t alignment)
+        {
+            return (bytes + alignment - 1) & ~(alignment - 1);
+        }
+
+        static size_t SizeClass(size_t bytes)
+        {
+            bytes = bytes < CACHE_LINE_SIZE ? CACHE_LINE_SIZE : bytes;
+            // big blocks are whole pages
+            if (bytes >= PageSize())
+                bytes = RoundUp(bytes, PageSize());
+            const size_t log = 63 - __builtin_clzll(bytes);
+            bytes = RoundUp(bytes, (size_t)1 << (log - 2));
+            const size_t classLog = 63 - __builtin_clzll(bytes);
+            return classLog * 4 + ((bytes >> (classLog - 2)) & 3);
+        }
+        static size_t ClassBytes(size_t sizeClass)
+        {
+            return (4 + sizeClass % 4) << (sizeClass / 4 - 2);
+        }
+    };
+
+    template <class Memory>
+    struct IsSharedMemory
+    {
+        static const bool value = false;
+    };
+    template <>
+    struct IsSharedMemory<SharedMemory>
+    {
+        static const bool value = true;
+    };
+}
@@ -52,6 +52,12 @@ static inline void AtomicBarrier()
     __sync_synchronize();
 }
 
+// orders stores for other threads on x86, which doesn't reorder them itself
+static inline void CompilerBarrier()
+{
+    __asm__ __volatile__("" : : : "memory");
+}
+
 class SpinLock
 {
 private:
@@ -336,6 +342,7 @@ private:
 #define EXPECT_TRUE(Cond) __builtin_expect(!!(Cond), 1)
 #define EXPECT_FALSE(Cond) __builtin_expect(!!(Cond), 0)
 #define FORCED_INLINE inline __attribute__ ((always_inline))
+#define PREFETCH_FOR_READ(Addr) __builtin_prefetch((const void*)(Addr), 0, 3)
 
 inline size_t CurrentThreadId()
 {
@@ -3,6 +3,7 @@
 #include "atomic.h"
 
 #include <string>
+#include <type_traits>
 
 namespace NLFHT
 {
@@ -16,6 +17,14 @@ namespace NLFHT
         return ::AtomicCas((Atomic*)target, (AtomicBase)exchange, (AtomicBase)compare);
     }
 
+    // keys and values, which mean the same in other process,
+    // so they are written to snapshots and table files raw
+    template <class T>
+    struct IsPlainData
+    {
+        static const bool value = std::is_trivially_copyable<T>::value && !std::is_pointer<T>::value;
+    };
+
     // traits classes declarations
 
     template <class T>
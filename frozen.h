@@ -0,0 +1,121 @@
+#pragma once
+
+#include "atomic.h"
+#include "atomic_traits.h"
+
+#include <type_traits>
+#include <vector>
+
+#include <stdint.h>
+
+namespace NLFHT
+{
+    // Immutable table for keys, which are loaded once and then only read
+    // (see LFHashTable::Freeze and LFHashTable::Thaw).
+    // Entries are packed densely and grouped by buckets: entries of bucket b
+    // are [m_Offsets[b], m_Offsets[b + 1]), so there are no empty entries,
+    // no reserved keys or values and nothing is ever copied. Lookup is plain
+    // loads without guards and is safe from any number of threads.
+    // Keys and values are copied raw, without key and value managers,
+    // so they must be plain data.
+    template <class K, class V, class HashFunc, class KeysAreEqual>
+    class FrozenTable
+    {
+        static_assert(std::is_trivially_copyable<K>::value, "frozen table copies keys raw");
+        static_assert(std::is_trivially_copyable<V>::value, "frozen table copies values raw");
+
+    public:
+        // average keys of bucket is BUCKET_LOAD / 2 .. BUCKET_LOAD,
+        // bucket is one or two cache lines
+        static const size_t BUCKET_LOAD = 2;
+
+        struct Entry
+        {
+            K m_Key;
+            V m_Value;
+        };
+
+        FrozenTable(const HashFunc& hash, const KeysAreEqual& keysAreEqual)
+            : m_Hash(hash)
+            , m_KeysAreEqual(keysAreEqual)
+            , m_BucketMask(0)
+            , m_Offsets(2, 0)
+        {
+        }
+
+        // NOT thread-safe: table is filled by Add, keys must be unique,
+        // then Build groups them by buckets
+        void Reserve(size_t entryCnt)
+        {
+            m_Entries.reserve(entryCnt);
+        }
+        void Add(const K& key, const V& value)
+        {
+            const Entry entry = {key, value};
+            m_Entries.push_back(entry);
+        }
+        void Build();
+
+        // 0 if there is no key
+        inline const V* Find(const K& key) const
+        {
+            const size_t bucket = m_Hash(key) & m_BucketMask;
+            const Entry* end = m_Entries.data() + m_Offsets[bucket + 1];
+            for (const Entry* cur = m_Entries.data() + m_Offsets[bucket]; cur != end; ++cur)
+                if (m_KeysAreEqual(cur->m_Key, key))
+                    return &cur->m_Value;
+            return 0;
+        }
+        // NONE value if there is no key, as LFHashTable::Get gives
+        inline V Get(const K& key) const
+        {
+            const V* value = Find(key);
+            return value ? *value : ValueTraits<V>::None();
+        }
+
+        size_t Size() const
+        {
+            return m_Entries.size();
+        }
+        // entries in order of buckets
+        const Entry* Entries() const
+        {
+            return m_Entries.data();
+        }
+        size_t AllocatedBytes() const
+        {
+            return m_Entries.capacity() * sizeof(Entry) + m_Offsets.capacity() * sizeof(uint32_t);
+        }
+
+    private:
+        HashFunc m_Hash;
+        KeysAreEqual m_KeysAreEqual;
+        size_t m_BucketMask;
+        std::vector<uint32_t> m_Offsets;
+        std::vector<Entry> m_Entries;
+    };
+
+    template <class K, class V, class HashFunc, class KeysAreEqual>
+    void FrozenTable<K, V, HashFunc, KeysAreEqual>::Build()
+    {
+        VERIFY(m_Entries.size() < ((size_t)1 << 32), "Too many keys for frozen table\n");
+        size_t bucketCnt = 1;
+        while (bucketCnt * BUCKET_LOAD < m_Entries.size())
+            bucketCnt *= 2;
+        m_BucketMask = bucketCnt - 1;
+
+        // counting sort by buckets
+        std::vector<uint32_t> offsets(bucketCnt + 1, 0);
+        for (size_t i = 0; i < m_Entries.size(); ++i)
+            ++offsets[(m_Hash(m_Entries[i].m_Key) & m_BucketMask) + 1];
+        for (size_t bucket = 0; bucket < bucketCnt; ++bucket)
+            offsets[bucket + 1] += offsets[bucket];
+        std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+        std::vector<Entry> entries(m_Entries.size());
+        for (size_t i = 0; i < m_Entries.size(); ++i)
+            entries[next[m_Hash(m_Entries[i].m_Key) & m_BucketMask]++] = m_Entries[i];
+
+        m_Offsets.swap(offsets);
+        m_Entries.swap(entries);
+    }
+}
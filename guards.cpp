@@ -2,6 +2,10 @@
 #include "lfht.h"
 
 #include <limits>
+#include <utility>
+#include <vector>
+
+#include <sched.h>
 
 namespace NLFHT {
     const AtomicBase BaseGuard::NO_TABLE = std::numeric_limits<AtomicBase>::max();
@@ -33,9 +37,12 @@ namespace NLFHT {
     BaseGuard::BaseGuard(BaseGuardManager* parent)
         : Next(0)
         , m_Parent(parent)
+        , m_OperationCnt(0)
         , m_AliveCnt(0)
         , m_KeyCnt(0)
+        , m_DeleteCnt(0)
         , m_ThreadId(size_t(-1))
+        , m_ProcessId(0)
     {
         Init();
 #ifndef NDEBUG
@@ -55,9 +62,12 @@ namespace NLFHT {
     {
         m_AliveCnt = 0;
         m_KeyCnt = 0;
+        m_DeleteCnt = 0;
+        m_CopyStatistics = CopyStatistics();
 
         m_GuardedTable = NO_TABLE;
         m_PTDLock = false;
+        m_Passive = false;
 
 #ifndef NDEBUG
         // JUST TO DEBUG
@@ -77,6 +87,8 @@ namespace NLFHT {
 #endif
         AtomicAdd(m_Parent->m_KeyCnt, m_KeyCnt);
         AtomicAdd(m_Parent->m_AliveCnt, m_AliveCnt);
+        if (m_CopyStatistics.m_TaskCnt)
+            m_Parent->m_CopyStatistics.Merge(m_CopyStatistics);
         Init();
     }
 
@@ -96,6 +108,7 @@ namespace NLFHT {
             if (current->m_ThreadId == size_t(-1)) {
                 size_t id = CurrentThreadId();
                 if (AtomicCas((Atomic*)&current->m_ThreadId, id, size_t(-1))) {
+                    current->m_ProcessId = getpid();
 #ifdef TRACE_MEM
                     Cerr << "Acquire " << (size_t)current << '\n';
 #endif
@@ -113,14 +126,14 @@ namespace NLFHT {
         return result;
     }
 
-    AtomicBase BaseGuardManager::TotalAliveCnt() {
+    AtomicBase BaseGuardManager::TotalAliveCnt() const {
         AtomicBase result = m_AliveCnt;
         for (BaseGuard* current = m_Head; current; current = current->Next)
             result += current->m_AliveCnt;
         return result;
     }
 
-    AtomicBase BaseGuardManager::TotalKeyCnt()
+    AtomicBase BaseGuardManager::TotalKeyCnt() const
     {
         AtomicBase result = m_KeyCnt;
         for (BaseGuard* current = m_Head; current; current = current->Next)
@@ -128,6 +141,21 @@ namespace NLFHT {
         return result;
     }
 
+    CopyStatistics BaseGuardManager::TotalCopyStatistics() const
+    {
+        CopyStatistics result = m_CopyStatistics;
+        for (BaseGuard* current = m_Head; current; current = current->Next)
+            result.Merge(current->m_CopyStatistics);
+        return result;
+    }
+
+    void BaseGuardManager::ResetCopyStatistics()
+    {
+        for (BaseGuard* current = m_Head; current; current = current->Next)
+            current->m_CopyStatistics = CopyStatistics();
+        m_CopyStatistics = CopyStatistics();
+    }
+
     void BaseGuardManager::ZeroKeyCnt()
     {
         for (BaseGuard* current = m_Head; current; current = current->Next)
@@ -143,6 +171,37 @@ namespace NLFHT {
         return true;
     }
 
+    void BaseGuardManager::WaitForActiveOperations()
+    {
+        // guards are read after changes of caller are visible
+        AtomicBarrier();
+        std::vector< std::pair<BaseGuard*, size_t> > active;
+        for (BaseGuard* current = m_Head; current; current = current->Next)
+            if (current->m_GuardedTable != BaseGuard::NO_TABLE && !current->m_Passive)
+            {
+                // client-held operation (*NoGuarding API) of caller is over only after return
+                VERIFY(current->m_ThreadId != CurrentThreadId() || current->m_ProcessId != getpid(),
+                       "Waiting for own operation\n");
+                active.push_back(std::make_pair(current, (size_t)current->m_OperationCnt));
+            }
+        // operation is finished, when guard stops guarding or counts it,
+        // so busy thread doesn't delay caller
+        for (size_t i = 0; i < active.size(); ++i)
+        {
+            BaseGuard* guard = active[i].first;
+            while (guard->m_GuardedTable != BaseGuard::NO_TABLE && !guard->m_Passive &&
+                   guard->m_OperationCnt == active[i].second)
+                sched_yield();
+        }
+    }
+
+    void BaseGuardManager::ReleaseGuardsOf(pid_t processId)
+    {
+        for (BaseGuard* current = m_Head; current; current = current->Next)
+            if (current->m_ThreadId != size_t(-1) && current->m_ProcessId == processId)
+                current->Release();
+    }
+
     // JUST TO DEBUG
 
     std::string BaseGuard::ToString()
@@ -199,6 +258,7 @@ namespace NLFHT {
         Cerr << "CreateGuard " << (size_t)guard << '\n';
 #endif
         guard->m_ThreadId = CurrentThreadId();
+        guard->m_ProcessId = getpid();
         while (true) {
             guard->Next = m_Head;
             if (AtomicCas(&m_Head, guard, guard->Next))
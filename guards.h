@@ -2,7 +2,11 @@
 
 #include <iostream>
 
+#include <sys/types.h>
+#include <unistd.h>
+
 #include "atomic.h"
+#include "migration.h"
 #include "unordered_map"
 
 #include "transp_holder.h"
@@ -42,6 +46,7 @@ namespace NLFHT
         void StopGuarding()
         {
             m_GuardedTable = NO_TABLE;
+            ++m_OperationCnt;
         }
 
         void ForbidPrepareToDelete()
@@ -53,6 +58,12 @@ namespace NLFHT
             m_PTDLock = false;
         }
 
+        // thread of passive guard doesn't write to tables, e.g. guard of pass
+        void SetPassive(bool passive)
+        {
+            m_Passive = passive;
+        }
+
         // JUST TO DEBUG
 #ifndef NDEBUG
         inline void OnLocalPut() {
@@ -106,6 +117,22 @@ namespace NLFHT
         {
             AtomicIncrement(m_KeyCnt);
         }
+        // for keys, put into table bypassing operations
+        inline void AddCnt(AtomicBase aliveCnt, AtomicBase keyCnt)
+        {
+            AtomicAdd(m_AliveCnt, aliveCnt);
+            AtomicAdd(m_KeyCnt, keyCnt);
+        }
+        // copy task of operation of thread, timed with copy budget
+        inline void OnCopyTask(size_t entryCnt, uint64_t ns)
+        {
+            m_CopyStatistics.Add(entryCnt, ns);
+        }
+        // true once per period deletes of thread
+        inline bool CountDelete(size_t period)
+        {
+            return ++m_DeleteCnt % period == 0;
+        }
 
         // JUST TO DEBUG
         virtual std::string ToString();
@@ -124,7 +151,11 @@ namespace NLFHT
         BaseGuardManager* m_Parent;
 
         volatile size_t m_GuardedTable;
+        // operations, finished by threads of guard, it's never reset,
+        // see BaseGuardManager::WaitForActiveOperations
+        volatile size_t m_OperationCnt;
         volatile bool m_PTDLock;
+        volatile bool m_Passive;
         // to exclude probability, that data from different
         // tables are in the same cache line
         char Padding[CACHE_LINE_SIZE];
@@ -137,8 +168,14 @@ namespace NLFHT
 
         Atomic m_AliveCnt;
         Atomic m_KeyCnt;
+        // only owner thread touches it
+        size_t m_DeleteCnt;
+        // only owner thread changes it, readers sum it approximately
+        CopyStatistics m_CopyStatistics;
 
         volatile size_t m_ThreadId;
+        // guards of table in SharedMemory are taken by threads of several processes
+        volatile pid_t m_ProcessId;
     };
 
     class ThreadGuardTable : NonCopyable
@@ -177,13 +214,23 @@ namespace NLFHT
         size_t GetFirstGuardedTable();
 
         // returns approximate value
-        AtomicBase TotalAliveCnt();
+        AtomicBase TotalAliveCnt() const;
 
         // returns approximate value
-        AtomicBase TotalKeyCnt();
+        AtomicBase TotalKeyCnt() const;
+        // sum of guards' statistics, approximate
+        CopyStatistics TotalCopyStatistics() const;
+        // NOT thread-safe
+        void ResetCopyStatistics();
         void ZeroKeyCnt();
 
         bool CanPrepareToDelete();
+        // waits till operations, which are going on now, are finished;
+        // operations, started later, see everything done before the call
+        void WaitForActiveOperations();
+        // for table shared by processes: gives back guards of process,
+        // which exited without forgetting its threads
+        void ReleaseGuardsOf(pid_t processId);
 
         // JUST TO DEBUG
         void PrintStatistics(std::ostream& str);
@@ -231,6 +278,8 @@ namespace NLFHT
 
         Atomic m_AliveCnt;
         Atomic m_KeyCnt;
+        // of released guards, changed under no lock by Release, approximate
+        CopyStatistics m_CopyStatistics;
 
 #ifndef NDEBUG
         Atomic m_GuardsCreated;
@@ -255,6 +304,16 @@ namespace NLFHT
             : BaseGuard(parent)
         {
         }
+
+        // guards live where tables do, so table in SharedMemory has shared guards
+        static void* operator new(size_t bytes)
+        {
+            return Prt::Policy::Memory::Allocate(bytes);
+        }
+        static void operator delete(void* ptr, size_t bytes)
+        {
+            Prt::Policy::Memory::Deallocate(ptr, bytes);
+        }
     };
 
     template <class Prt>
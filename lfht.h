@@ -3,13 +3,27 @@
 #include "table.h"
 #include "guards.h"
 #include "managers.h"
-
+#include "policy.h"
+#include "migration.h"
+#include "frozen.h"
+#include "snapshot.h"
+#include "tablefile.h"
+#include "operations.h"
+
+#include <algorithm>
 #include <cstdlib>
 #include <cmath>
 #include <limits>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
 #include <iostream>
 
+#include <sched.h>
+#include <unistd.h>
+
 namespace NLFHT
 {
     class Registrable
@@ -39,14 +53,17 @@ namespace NLFHT
         };
     };
 
+    // guards operation of table T till the end of scope, also when it throws;
+    // guard of outer operation is restored, as operation can be called by outer table
     template <class T>
-    class Guarding
+    class Guarding : NonCopyable
     {
     public:
-        typedef typename T::TSearchHint SearchHint;
+        typedef typename T::SearchHint SearchHint;
 
         Guarding(T& table, SearchHint* hint)
             : m_Table(table)
+            , m_LastGuard(T::m_Guard)
         {
             m_Table.StartGuarding(hint);
         }
@@ -54,10 +71,12 @@ namespace NLFHT
         ~Guarding()
         {
             m_Table.StopGuarding();
+            T::m_Guard = m_LastGuard;
         }
 
     private:
         T& m_Table;
+        typename T::Guard* m_LastGuard;
     };
 
     template <class Prt>
@@ -119,6 +138,160 @@ namespace NLFHT
     private:
         TableConstIterator Impl;
     };
+
+    // Weakly consistent iterator, can be used while other threads modify table.
+    // It holds its own guard, so tables are not deleted under it, and never blocks writers.
+    // Every key, which is alive during whole iteration, is visited exactly once,
+    // keys put or deleted meanwhile are visited at most once, with the latest value seen.
+    // Like ConstIterator, it doesn't reference values.
+    template <class Prt>
+    class GuardedIterator : NonCopyable
+    {
+    public:
+        typedef typename Prt::Self Parent;
+        typedef typename Parent::Table Table;
+        typedef typename Parent::Guard Guard;
+
+        typedef typename Parent::Key TKey;
+        typedef typename Parent::Value TValue;
+
+        GuardedIterator(Parent& parent)
+            : m_Parent(parent)
+            , m_Guard(parent.AcquirePassGuard())
+            , m_Index((size_t)-1)
+        {
+            // all tables from head on are safe now
+            m_First = m_Table = m_Parent.m_Head;
+            NextEntry();
+        }
+
+        ~GuardedIterator()
+        {
+            m_Parent.ReleasePassGuard(m_Guard);
+        }
+
+        inline TKey Key() const
+        {
+            return m_Key;
+        }
+
+        inline TValue Value() const
+        {
+            return m_Value;
+        }
+
+        GuardedIterator& operator ++ ()
+        {
+            NextEntry();
+            return *this;
+        }
+
+        bool IsValid() const
+        {
+            return m_Table != 0;
+        }
+
+    private:
+        void NextEntry()
+        {
+            // lookups in tables account statistics in guard of operation
+            Guard* lastGuard = Parent::m_Guard;
+            Parent::m_Guard = m_Guard;
+            while (m_Table)
+            {
+                for (m_Index = m_Table->NextToVisit(m_Index + 1); m_Index < m_Table->m_Size;
+                     m_Index = m_Table->NextToVisit(m_Index + 1))
+                    if (m_Table->GetAliveEntry(m_Index, m_First, m_Key, m_Value))
+                    {
+                        Parent::m_Guard = lastGuard;
+                        return;
+                    }
+                m_Table = m_Table->GetNext();
+                m_Index = (size_t)-1;
+            }
+            Parent::m_Guard = lastGuard;
+        }
+
+    private:
+        Parent& m_Parent;
+        Guard* m_Guard;
+
+        Table* m_First;
+        Table* m_Table;
+        size_t m_Index;
+
+        TKey m_Key;
+        TValue m_Value;
+    };
+
+    // Point-in-time iterator: visits keys and values, which were in table at one moment,
+    // while other threads go on modifying it. Head table is frozen (see LFHashTable::FreezeHead)
+    // and is iterated alone, it's kept until iterator is destroyed.
+    // Nested point-in-time pass of the same thread throws std::logic_error,
+    // calling thread must be outside of operations (see SearchHint).
+    // Like ConstIterator, it doesn't reference values.
+    template <class Prt>
+    class ConsistentIterator : NonCopyable
+    {
+    public:
+        typedef typename Prt::Self Parent;
+        typedef typename Parent::Table Table;
+        typedef typename Parent::Guard Guard;
+
+        typedef typename Parent::Key TKey;
+        typedef typename Parent::Value TValue;
+
+        ConsistentIterator(Parent& parent)
+            : m_Parent(parent)
+            , m_Table(parent.FreezeHead(m_Guard))
+            , m_Index((size_t)-1)
+        {
+            NextEntry();
+        }
+
+        ~ConsistentIterator()
+        {
+            m_Parent.UnfreezeHead(m_Table, m_Guard);
+        }
+
+        inline TKey Key() const
+        {
+            return m_Key;
+        }
+
+        inline TValue Value() const
+        {
+            return m_Value;
+        }
+
+        ConsistentIterator& operator ++ ()
+        {
+            NextEntry();
+            return *this;
+        }
+
+        bool IsValid() const
+        {
+            return m_Index < m_Table->m_Size;
+        }
+
+    private:
+        void NextEntry()
+        {
+            while (++m_Index < m_Table->m_Size && !m_Table->GetFrozenEntry(m_Index, m_Key, m_Value))
+            {
+            }
+        }
+
+    private:
+        Parent& m_Parent;
+        Guard* m_Guard;
+        Table* m_Table;
+        size_t m_Index;
+
+        TKey m_Key;
+        TValue m_Value;
+    };
 }
 
 class TLFHTRegistration : NonCopyable
@@ -147,22 +320,28 @@ template <
     class ValCmp = EqualToF<Val>,
     class Alloc = DEFAULT_ALLOCATOR(Val),
     class KeyMgr = NLFHT::Proxy<NLFHT::DefaultKeyManager>,
-    class ValMgr = NLFHT::Proxy<NLFHT::DefaultValueManager>
+    class ValMgr = NLFHT::Proxy<NLFHT::DefaultValueManager>,
+    class TablePolicy = NLFHT::DefaultTablePolicy
 >
 class LFHashTable : public NLFHT::LFHashTableBase
 {
 public:
-    typedef LFHashTable<K, Val, KeyCmp, HashFn, ValCmp, Alloc, KeyMgr, ValMgr> Self;
+    typedef LFHashTable<K, Val, KeyCmp, HashFn, ValCmp, Alloc, KeyMgr, ValMgr, TablePolicy> Self;
 
     friend class NLFHT::Guarding<Self>;
     friend class NLFHT::Table<Self>;
     friend class NLFHT::ConstIterator<Self>;
+    friend class NLFHT::GuardedIterator<Self>;
+    friend class NLFHT::ConsistentIterator<Self>;
+    friend class NLFHT::MigrationWorkers<Self>;
+    friend class NLFHT::TableOperations<Self>;
 
     typedef K Key;
     typedef Val Value;
     typedef KeyCmp KeyComparator;
     typedef ValCmp ValueComparator;
     typedef Alloc Allocator;
+    typedef TablePolicy Policy;
     typedef typename KeyMgr::template TRedirected<Self> KeyManager;
     typedef typename ValMgr::template TRedirected<Self> ValueManager;
 
@@ -180,53 +359,28 @@ public:
 
     typedef typename NLFHT::Entry<Key, Value> Entry;
     typedef typename NLFHT::ConstIterator<Self> ConstIterator;
-
-    typedef typename Allocator::template rebind<Table>::other TableAllocator;
-
-    // class incapsulates CAS possibility
-    struct PutCondition
-    {
-        enum EWhenToPut
-        {
-            ALWAYS,
-            IF_ABSENT, // put if THERE IS NO KEY in table. Can put only NONE in this way.
-            IF_EXISTS, // put if THERE IS KEY
-            IF_MATCHES, // put if THERE IS KEY and VALUE MATCHES GIVEN ONE
-
-            COPYING // reserved for TTable internal use
-        };
-
-        EWhenToPut m_When;
-        Value m_Value;
-
-        PutCondition(EWhenToPut when = ALWAYS, Value value = ValueNone())
-            : m_When(when)
-            , m_Value(value)
-        {
-        }
-
-        // TO DEBUG ONLY
-        std::string ToString() const
-        {
-            std::stringstream tmp;
-            if (m_When == ALWAYS)
-                tmp << "ALWAYS";
-            else if (m_When == IF_EXISTS)
-                tmp << "IF_EXISTS";
-            else if (m_When == IF_ABSENT)
-                tmp << "IF_ABSENT";
-            else
-                tmp << "IF_MATCHES";
-            tmp << " with " << ValueToString(m_Value);
-            return tmp.str();
-        }
-    };
+    // construct it from table: for (GuardedIterator it(table); it.IsValid(); ++it)
+    typedef typename NLFHT::GuardedIterator<Self> GuardedIterator;
+    // the same for point-in-time view, calling thread must be outside of operations
+    typedef typename NLFHT::ConsistentIterator<Self> ConsistentIterator;
+    typedef NLFHT::FrozenTable<Key, Value, HashFunc, KeysAreEqual> FrozenTable;
+
+    typedef NLFHT::PutCondition<Value> PutCondition;
+
+    // table object in SharedMemory is used by several processes: keys and values
+    // are stored as they are, nothing may point to heap of one of them
+    static const bool IS_SHARED = NLFHT::IsSharedMemory<typename TablePolicy::Memory>::value;
+    static_assert(!IS_SHARED || (std::is_trivially_copyable<K>::value && std::is_trivially_copyable<Val>::value &&
+                                 std::is_same<KeyMgr, NLFHT::Proxy<NLFHT::DefaultKeyManager> >::value &&
+                                 std::is_same<ValMgr, NLFHT::Proxy<NLFHT::DefaultValueManager> >::value),
+                  "table in SharedMemory keeps plain keys and values with default managers only");
 
     class SearchHint
     {
         public:
-            friend class LFHashTable<Key, Val, KeyCmp, HashFn, ValCmp, Alloc, KeyMgr, ValMgr>;
-            friend class NLFHT::Table< LFHashTable<Key, Val, KeyCmp, HashFn, ValCmp, Alloc, KeyMgr, ValMgr> >;
+            friend class LFHashTable<Key, Val, KeyCmp, HashFn, ValCmp, Alloc, KeyMgr, ValMgr, TablePolicy>;
+            friend class NLFHT::Table< LFHashTable<Key, Val, KeyCmp, HashFn, ValCmp, Alloc, KeyMgr, ValMgr, TablePolicy> >;
+            friend class NLFHT::TableOperations< LFHashTable<Key, Val, KeyCmp, HashFn, ValCmp, Alloc, KeyMgr, ValMgr, TablePolicy> >;
 
         public:
             SearchHint()
@@ -240,15 +394,15 @@ public:
 
             AtomicBase m_TableNumber;
             Table* m_Table;
-            Entry* m_Entry;
+            size_t m_EntryIndex;
             bool m_KeySet;
 
         private:
-            SearchHint(AtomicBase tableNumber, Table* table, Entry* entry, bool keySet)
+            SearchHint(AtomicBase tableNumber, Table* table, size_t entryIndex, bool keySet)
                 : m_Guard(0)
                 , m_TableNumber(tableNumber)
                 , m_Table(table)
-                , m_Entry(entry)
+                , m_EntryIndex(entryIndex)
                 , m_KeySet(keySet)
             {
             }
@@ -260,6 +414,7 @@ public:
                  const HashFn& hash = HashFn(),
                  const ValueComparator& valuesAreEqual = ValCmp());
     LFHashTable(const LFHashTable& other);
+    ~LFHashTable();
 
     // NotFound value getter to compare with
     inline static Value NotFound()
@@ -269,6 +424,11 @@ public:
 
     // return NotFound value if there is no such key
     Value Get(Key key, SearchHint* hint = 0);
+    // values[i] = Get(keys[i]), but the whole batch is done under one guard
+    // and lookups are pipelined with prefetches of home entries
+    void GetMany(const Key* keys, size_t n, Value* values, SearchHint* hint = 0);
+    // starts loading of key home entry into cache, to be Get-ed later
+    void Prefetch(Key key, SearchHint* hint = 0);
     // returns true if condition was matched
     void Put(Key key, Value value, SearchHint* hint = 0);
     bool PutIfMatch(Key key, Value newValue, Value oldValue, SearchHint *hint = 0);
@@ -282,8 +442,19 @@ public:
     bool Delete(Key key, SearchHint* hint = 0);
     bool DeleteIfMatch(Key key, Value oldValue, SearchHint* hint = 0);
 
+    // Batch versions of Put, PutIfAbsent and Delete.
+    // The whole batch is done under one guard, copying is helped and old tables
+    // are reclaimed once per batch. Keys are processed in order of their home
+    // entries (repeated keys - in batch order), so writes walk table memory forward.
+    // If results are given, results[i] is what single key method returns for keys[i].
+    void PutMany(const Key* keys, const Value* values, size_t n, bool* results = 0, SearchHint* hint = 0);
+    void PutIfAbsentMany(const Key* keys, const Value* values, size_t n, bool* results = 0, SearchHint* hint = 0);
+    void DeleteMany(const Key* keys, size_t n, bool* results = 0, SearchHint* hint = 0);
+
     // assume, that StartGuarding and StopGuarding are called by client (by creating TGuarding on stack)
     Value GetNoGuarding(Key key, SearchHint* hint = 0);
+    void GetManyNoGuarding(const Key* keys, size_t n, Value* values, SearchHint* hint = 0);
+    void PrefetchNoGuarding(Key key, SearchHint* hint = 0);
 
     void PutNoGuarding(Key key, Value value, SearchHint* hint = 0);
     bool PutIfMatchNoGuarding(Key key, Value newValue, Value oldValue, SearchHint *hint = 0);
@@ -300,7 +471,20 @@ public:
         return m_ValuesAreEqual.GetImpl();
     }
 
-    size_t Size() const;
+    // number of alive keys, sum of counters of threads, so it costs O(threads);
+    // exact when there are no concurrent modifications
+    size_t Size() const
+    {
+        return SizeApprox();
+    }
+    // the same sum, can be read during modifications, e.g. by monitoring:
+    // it's approximate then, released guard can be counted twice for a moment
+    size_t SizeApprox() const
+    {
+        return Max((AtomicBase)0, m_GuardManager.TotalAliveCnt());
+    }
+    // JUST TO DEBUG, NOT thread-safe: counts keys by iterating all tables
+    size_t SizeByScan() const;
     bool Empty() const
     {
         return Size() == 0;
@@ -338,15 +522,11 @@ public:
 
     virtual void RegisterThread()
     {
-        NLFHT::ThreadGuardTable::RegisterTable(this);
-        m_KeyManager.RegisterThread();
-        m_ValueManager.RegisterThread();
+        NLFHT::TableOperations<Self>::RegisterThread(*this);
     }
     virtual void ForgetThread()
     {
-        m_ValueManager.ForgetThread();
-        m_KeyManager.ForgetThread();
-        NLFHT::ThreadGuardTable::ForgetTable(this);
+        NLFHT::TableOperations<Self>::ForgetThread(*this);
     }
     virtual NLFHT::BaseGuard* AcquireGuard()
     {
@@ -368,6 +548,116 @@ public:
     {
         m_GuardManager.PrintStatistics(str);
     }
+    // Copying of old tables to new ones in threadCnt background threads,
+    // operations help copying only if it lags behind by more than maxLag tables
+    void StartMigrationThreads(size_t threadCnt = 1, size_t maxLag = 0)
+    {
+        static_assert(!IS_SHARED, "workers of one process can't be woken by others");
+        m_Migration.Start(threadCnt, maxLag);
+    }
+    void StopMigrationThreads()
+    {
+        m_Migration.Stop();
+    }
+    // Time, which every operation may spend copying old table, in ns.
+    // Size of copy task is adapted to measured copy speed,
+    // zero budget (default) means fixed task size.
+    void SetCopyBudget(size_t budgetNs)
+    {
+        m_CopyPacer.SetBudget(budgetNs);
+    }
+    // time, spent by operations in copy tasks, measured with budget only
+    NLFHT::CopyStatistics GetCopyStatistics() const
+    {
+        return m_GuardManager.TotalCopyStatistics();
+    }
+    // NOT thread-safe
+    void ResetCopyStatistics()
+    {
+        m_GuardManager.ResetCopyStatistics();
+    }
+    // calling thread must be registered as for other operations:
+    // part of head table, which is copied to the next one, 1 if there is no migration
+    double MigrationProgress();
+    // returns when there is no migration in progress,
+    // copies by itself if there are no migration threads
+    void WaitForMigration();
+    // copies alive keys to new table sized by their number, drops tombstones;
+    // calling thread must be registered, returns when copying is done
+    void ShrinkToFit();
+    // weakly consistent pass over all keys, the same as GuardedIterator gives;
+    // fn(key, value) is called concurrently from threadCnt threads, including
+    // calling one, which must be registered; tables are split into chunks,
+    // which threads take one by one, so fast threads do more
+    template <class Fn>
+    void ParallelForEach(Fn fn, size_t threadCnt);
+    // combine(result, map(key, value)) over all keys by the same pass,
+    // init must be neutral element of combine
+    template <class T, class Map, class Combine>
+    T ParallelReduce(const T& init, Map map, Combine combine, size_t threadCnt);
+
+    // writes alive keys and values to file at path by weakly consistent pass
+    // (see ParallelForEach) of threadCnt threads, keys and values must be plain data;
+    // consistent one writes them as of one moment, see ConsistentIterator;
+    // calling thread must be registered and outside of operations,
+    // throws std::runtime_error on I/O errors
+    void SaveSnapshot(const std::string& path, size_t threadCnt = 1, bool consistent = false);
+    // NOT thread-safe, table must be empty: maps file, written by SaveSnapshot,
+    // and fills new head table of the right size directly, without operations;
+    // calling thread must be registered, throws std::runtime_error on I/O errors
+    void LoadSnapshot(const std::string& path);
+    // checkpoints with Policy::DIRTY_REGION_BYTES: writes keys of regions, changed
+    // since previous checkpoint (this call or SaveSnapshot), with their current values,
+    // deleted ones with NotFound value; calling thread must be registered and
+    // outside of operations, throws std::runtime_error on I/O errors
+    void WriteDelta(const std::string& path);
+    // puts and deletes keys of delta in order of file: base snapshot
+    // and deltas after it are applied in order they were written
+    void ApplyDelta(const std::string& path);
+
+    // NOT thread-safe, table must be new: tables live in files of dir from now on,
+    // mapped shared (see TableFile), new tables are new files and retired ones
+    // are removed; chain of tables found in dir is used as is, without reload.
+    // Entries are kept in page cache, when process exits, only Sync writes them
+    // to disk. For plain data keys and values; calling thread must be registered,
+    // throws std::runtime_error on I/O errors
+    void Open(const std::string& dir);
+    // NOT thread-safe, writes tables of opened table to disk;
+    // counters are saved too, so Open after Sync or destruction doesn't count keys
+    void Sync();
+
+    // copies keys by weakly consistent pass (see GuardedIterator) to immutable
+    // table, which is packed densely and is read without guards;
+    // calling thread must be registered, call it when writers are done
+    FrozenTable Freeze();
+    // NOT thread-safe, table must be empty: fills new head table of the right size
+    // directly by keys of frozen table; calling thread must be registered
+    void Thaw(const FrozenTable& frozen);
+
+    // makes room for n keys in advance: copies head to table of n / density entries,
+    // threadCnt - 1 extra threads help to copy; until next call n is lower bound
+    // for sizes of new tables, Reserve(0) removes it;
+    // calling thread must be registered, returns when copying is done
+    void Reserve(size_t n, size_t threadCnt = 1);
+
+    // NOT thread-safe, walks all tables
+    NLFHT::ProbeStatistics CollectProbeStatistics() const
+    {
+        NLFHT::ProbeStatistics stats;
+        for (const Table* cur = m_Head; cur; cur = cur->GetNext())
+            cur->CollectProbeStatistics(stats);
+        return stats;
+    }
+    // NOT thread-safe, bytes of all tables, including ones waiting for deletion
+    size_t AllocatedBytes() const
+    {
+        size_t result = 0;
+        for (const Table* cur = m_Head; cur; cur = cur->GetNext())
+            result += cur->m_AllocSize;
+        for (const Table* cur = m_HeadToDelete; cur; cur = cur->GetNextToDelete())
+            result += cur->m_AllocSize;
+        return result;
+    }
 
 private:
     class THeadWrapper : public NLFHT::VolatilePointerWrapper<Table>
@@ -380,17 +670,18 @@ private:
 
         inline THeadWrapper& operator= (Table* table)
         {
-            Set(table);
+            this->Set(table);
             return *this;
         }
 
         ~THeadWrapper()
         {
-            Table* current = Get();
+            Table* current = this->Get();
             while (current) {
                 Table* tmp = current;
                 current = current->GetNext();
-                m_Parent->DeleteTable(tmp);
+                // files of chain are kept for next Open
+                m_Parent->DeleteTable(tmp, false, true);
             }
 #ifndef NDEBUG
             if (m_Parent->m_TablesCreated != m_Parent->m_TablesDeleted)
@@ -415,13 +706,13 @@ private:
 
         inline THeadToDeleteWrapper& operator=(Table* table)
         {
-            Set(table);
+            this->Set(table);
             return *this;
         }
 
         ~THeadToDeleteWrapper()
         {
-            Table* current = Get();
+            Table* current = this->Get();
             while (current)
             {
                 Table* tmp = current;
@@ -433,8 +724,13 @@ private:
         LFHashTable* m_Parent;
     };
 
+    // deletes of thread between checks of head for compaction, see CompactIfSparse
+    static const size_t COMPACTION_CHECK_PERIOD = 1024;
+
     // is used by TTable
     double m_Density;
+    // new tables are sized for at least that many keys, see Reserve
+    volatile size_t m_ReservedCnt;
 
     // functors
     HashFunc m_Hash;
@@ -442,7 +738,11 @@ private:
     ValuesAreEqual m_ValuesAreEqual;
 
     // allocators
-    TableAllocator m_TableAllocator;
+    // tables are files there, if table is opened, see Open;
+    // process-local as m_Migration is, so both stay unused in SharedMemory
+    std::string m_Directory;
+    // number of the newest table file
+    Atomic m_FileNumber;
 
     // whole table structure
     THeadWrapper m_Head;
@@ -467,35 +767,268 @@ private:
     Atomic m_TablesDeleted;
 #endif
 
+    NLFHT::CopyPacer m_CopyPacer;
+
+    // the last member: workers are stopped before anything else is destroyed
+    NLFHT::MigrationWorkers<Self> m_Migration;
+
 private:
     template <bool ShouldSetGuard>
     Value GetImpl(const Key& key, SearchHint* hint = 0);
+    template <bool ShouldSetGuard>
+    void GetManyImpl(const Key* keys, size_t n, Value* values, SearchHint* hint = 0);
+    template <bool ShouldSetGuard>
+    void PrefetchImpl(const Key& key, SearchHint* hint = 0);
+    // searches key through all tables, must be called under guard
+    inline Value GetFromTables(const Key& key, size_t hashValue, SearchHint* hint);
 
     template <bool ShouldSetGuard, bool ShouldDeleteKey>
     bool PutImpl(const Key& key, const Value& value, const PutCondition& condition, SearchHint* hint = 0);
+    // values == 0 means NONE for all keys
+    template <bool ShouldDeleteKey>
+    void PutManyImpl(const Key* keys, const Value* values, size_t n, const PutCondition& condition,
+                     bool* results, SearchHint* hint);
+    // puts key through all tables, must be called under guard
+    template <bool ShouldDeleteKey>
+    inline bool PutToTables(const Key& key, size_t hashValue, const Value& value, const PutCondition& cond);
+
+    // copies chunk of head table, if head has next one
+    // and this work is not left to migration workers
+    inline void HelpCopying()
+    {
+        Table* head = m_Head;
+        if (EXPECT_FALSE(head->GetNext()) && m_Migration.ShouldHelp(head))
+            head->DoCopyTask();
+    }
+    // returns when head table has no next one, used by migration workers
+    void CopyOldTables();
+    // called under guard once in a while by deleting thread:
+    // starts copying of head, if it's mostly tombstones
+    void CompactIfSparse();
+    // body of helper threads of Reserve
+    void CopyOldTablesRegistered()
+    {
+        TLFHTRegistration registration(*this);
+        CopyOldTables();
+    }
+
+    // own guard of long pass over tables, protects tables from head on
+    Guard* AcquirePassGuard()
+    {
+        Guard* guard = dynamic_cast<Guard*>(AcquireGuard());
+        guard->SetPassive(true);
+        while (true)
+        {
+            const AtomicBase tableNumber = m_TableNumber;
+            guard->GuardTable(tableNumber);
+            AtomicBarrier();
+            if (EXPECT_TRUE(m_TableNumber == tableNumber))
+                return guard;
+        }
+    }
+    void ReleasePassGuard(Guard* guard)
+    {
+        guard->StopGuarding();
+        guard->Release();
+    }
+
+    // makes head a frozen version of all keys without copying it: the first
+    // change of entry since then, by operation or by copying to next table,
+    // saves its value; operations, which are going on at freezing, are seen
+    // or not, as if they were done before or after it. Returns head with
+    // pass guard, which UnfreezeHead releases; throws std::logic_error,
+    // if calling thread has frozen head already
+    Table* FreezeHead(Guard*& guard);
+    // waits for operations, so calling thread must be outside of them
+    void UnfreezeHead(Table* frozen, Guard* guard);
+    // returns when operations, which started before, are done or passive;
+    // operation of calling thread would never be done
+    void WaitForActiveOperations();
+
+    struct DirtyWord
+    {
+        Table* m_Table;
+        size_t m_Word;
+        AtomicBase m_Bits;
+    };
+    // under pass guard: clears dirty bits of tables from head on, remembers them if dirty is given
+    void TakeDirty(std::vector<DirtyWord>* dirty);
+
+    // parallel pass: chunks of tables, which follow the first one at pass start
+    static const size_t PASS_CHUNK_SIZE = 1 << 14;
+    struct ParallelPass
+    {
+        Guard* m_Guard;
+        // frozen table is the only one
+        bool m_Frozen;
+        std::vector<Table*> m_Tables;
+        // number of chunks in tables up to i-th one, inclusive
+        std::vector<size_t> m_ChunkEnd;
+        Atomic m_NextChunk;
+    };
+    // workers[i] is called by i-th thread
+    template <class Worker>
+    void RunParallelPass(std::vector<Worker>& workers, Table* frozen = 0);
+    template <class Worker>
+    void DoParallelPass(ParallelPass& pass, Worker& worker);
+    template <class Worker>
+    void DoParallelPassRegistered(ParallelPass& pass, Worker& worker)
+    {
+        TLFHTRegistration registration(*this);
+        DoParallelPass(pass, worker);
+    }
+    template <class Fn>
+    struct ForEachWorker
+    {
+        Fn* m_Fn;
+
+        inline void operator () (const Key& key, const Value& value)
+        {
+            (*m_Fn)(key, value);
+        }
+    };
+    struct SnapshotEntry
+    {
+        Key m_Key;
+        Value m_Value;
+    };
+    // NOT thread-safe, table must be empty: {m_Key, m_Value} entries of snapshot
+    // or of frozen table go to new head directly, without operations
+    template <class E>
+    void LoadEntries(const E* entries, size_t entryCnt);
+    // buffers entries of pass and appends them to file by blocks
+    struct SnapshotWorker
+    {
+        static const size_t BLOCK_SIZE = 1 << 12;
+
+        NLFHT::SnapshotWriter* m_Writer;
+        std::vector<SnapshotEntry> m_Block;
+
+        inline void operator () (const Key& key, const Value& value)
+        {
+            const SnapshotEntry entry = {key, value};
+            m_Block.push_back(entry);
+            if (m_Block.size() == BLOCK_SIZE)
+                Flush();
+        }
+        void Flush()
+        {
+            if (!m_Block.empty())
+                m_Writer->Append(&m_Block[0], m_Block.size());
+            m_Block.clear();
+        }
+    };
+    template <class T, class Map, class Combine>
+    struct ReduceWorker
+    {
+        T m_Result;
+        Map* m_Map;
+        Combine* m_Combine;
+
+        inline void operator () (const Key& key, const Value& value)
+        {
+            m_Result = (*m_Combine)(m_Result, (*m_Map)(key, value));
+        }
+    };
+
+    // tables structure, used by Table
+    inline bool IsHead(const Table* table) const
+    {
+        return m_Head == table;
+    }
+    // called under lock of full table
+    void CreateNextTables(Table* table)
+    {
+        SetNextTable(table, CreateTable(this, NextTableSize()));
+    }
+    size_t NextTableSize() const
+    {
+        const size_t aliveCnt = Max((size_t)Max((AtomicBase)1, m_GuardManager.TotalAliveCnt()), (size_t)m_ReservedCnt);
+        return Max((size_t)1, (size_t)ceil(aliveCnt * (1. / m_Density)));
+    }
+    // is called under lock of table, so workers are notified after it's released
+    void SetNextTable(Table* table, Table* next)
+    {
+        m_GuardManager.ZeroKeyCnt();
+        table->SetNext(next);
+    }
+    inline void OnNextTableCreated()
+    {
+        m_Migration.Notify();
+    }
+    // removes copied head from list and schedules its deletion
+    void ThrowAway(Table* table);
+    inline void IncreaseKeyCnt(Table*)
+    {
+        m_Guard->IncreaseKeyCnt();
+    }
+    // keys installed since last table creation, approximate
+    inline size_t KeyCnt(const Table*)
+    {
+        return m_GuardManager.TotalKeyCnt();
+    }
 
     // thread-safefy and lock-free memory reclamation is done here
     inline void StopGuarding();
     inline void StartGuarding(SearchHint* hint);
 
-    void TryToDelete();
+    void TryToDelete()
+    {
+        NLFHT::TableOperations<Self>::TryToDelete(*this);
+    }
+    // list of tables has nothing else to free
+    inline void OnTablesDeleted(AtomicBase)
+    {
+    }
 
     // allocators usage wrappers
+    // table header and entries are one block of Policy::Memory or of table file
     Table* CreateTable(LFHashTable* parent, size_t size) {
-        Table* newTable = m_TableAllocator.allocate(1);
+        const size_t allocSize = Table::AllocSize(size);
+        Table* newTable;
+        if (m_Directory.empty())
+            newTable = (Table*)Policy::Memory::Allocate(allocSize);
+        else
+            newTable = (Table*)NLFHT::TableFile::Block(NLFHT::TableFile::Create(m_Directory,
+                AtomicIncrement(m_FileNumber), Table::RoundSize(size), allocSize, sizeof(SnapshotEntry),
+                NLFHT::TableFileLayout::Of<Policy>()));
         try
         {
             new (newTable) Table(parent, size);
-            newTable->m_AllocSize = size;
+            newTable->m_AllocSize = allocSize;
             return newTable;
         }
         catch (...)
         {
-            m_TableAllocator.deallocate(newTable, size);
+            FreeTableMemory(newTable, allocSize, false);
             throw;
         }
     }
-    void DeleteTable(Table* table, bool shouldDeleteKeys = false) {
+    // table of existing file, its entries are kept
+    Table* AttachTable(const std::string& dir, uint64_t number) {
+        NLFHT::TableFileHeader* header = NLFHT::TableFile::Open(dir, number, sizeof(SnapshotEntry));
+        if (!(header->m_Layout == NLFHT::TableFileLayout::Of<Policy>()) ||
+            Table::AllocSize(header->m_TableSize) != header->m_AllocSize)
+        {
+            NLFHT::TableFile::Close(header);
+            errno = EINVAL;
+            NLFHT::ThrowTableFileError(NLFHT::TableFile::Path(dir, number), "other table layout");
+        }
+        Table* table = (Table*)NLFHT::TableFile::Block(header);
+        new (table) Table(this, header->m_TableSize, true);
+        table->m_AllocSize = header->m_AllocSize;
+        return table;
+    }
+    // file of table is removed unless it's kept
+    void FreeTableMemory(Table* table, size_t allocSize, bool keepFile) {
+        if (m_Directory.empty())
+            Policy::Memory::Deallocate(table, allocSize);
+        else if (keepFile)
+            NLFHT::TableFile::Close(NLFHT::TableFile::HeaderOf(table));
+        else
+            NLFHT::TableFile::Remove(m_Directory, NLFHT::TableFile::HeaderOf(table));
+    }
+    void DeleteTable(Table* table, bool shouldDeleteKeys = false, bool keepFile = false) {
 #ifdef TRACE
         Trace(Cerr, "DeleteTable %zd\n", (size_t)table);
 #endif
@@ -506,8 +1039,19 @@ private:
                 UnRefKey(it.Key());
             }
         }
-        m_TableAllocator.destroy(table);
-        m_TableAllocator.deallocate(table, table->m_AllocSize);
+        const size_t allocSize = table->m_AllocSize;
+        table->~Table();
+        FreeTableMemory(table, allocSize, keepFile);
+    }
+    // counters go to header of the newest file, so Open doesn't count keys
+    void SaveCounters(bool clean) {
+        Table* last = m_Head;
+        while (last->GetNext())
+            last = last->GetNext();
+        NLFHT::TableFileHeader* header = NLFHT::TableFile::HeaderOf(last);
+        header->m_AliveCnt = m_GuardManager.TotalAliveCnt();
+        header->m_KeyCnt = m_GuardManager.TotalKeyCnt();
+        header->m_Clean = clean;
     }
 
     // destructing
@@ -537,12 +1081,6 @@ private:
         m_ValueManager.UnRef(value, cnt);
     }
 
-    // guard getting wrapper
-    Guard* GuardForTable()
-    {
-        return dynamic_cast<Guard*>(NLFHT::ThreadGuardTable::ForTable(this));
-    }
-
     // JUST TO DEBUG
     static std::string KeyToString(const Key& key)
     {
@@ -567,18 +1105,20 @@ private:
 
 // need dirty hacks to avoid problems with macros that accept template as a parameter
 
-template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-NLFHT_THREAD_LOCAL NLFHT::Guard< LFHashTable<K, V, KC, HF, VC, A, KM, VM> >* LFHashTable<K, V, KC, HF, VC, A, KM, VM>::m_Guard((Guard*)0);
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+NLFHT_THREAD_LOCAL NLFHT::Guard< LFHashTable<K, V, KC, HF, VC, A, KM, VM, P> >* LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::m_Guard((Guard*)0);
 
-template <typename K, typename V, class KC, class HashFn, class VC, class A, class KM, class VM>
-LFHashTable<K, V, KC, HashFn, VC, A, KM, VM>::LFHashTable(size_t initialSize, double density,
+template <typename K, typename V, class KC, class HashFn, class VC, class A, class KM, class VM, class P>
+LFHashTable<K, V, KC, HashFn, VC, A, KM, VM, P>::LFHashTable(size_t initialSize, double density,
                                  const KeyComparator& keysAreEqual,
                                  const HashFn& hash,
                                  const ValueComparator& valuesAreEqual)
     : m_Density(density)
+    , m_ReservedCnt(0)
     , m_Hash(hash)
     , m_KeysAreEqual(keysAreEqual)
     , m_ValuesAreEqual(valuesAreEqual)
+    , m_FileNumber(0)
     , m_Head(this)
     , m_HeadToDelete(this)
     , m_GuardManager(this)
@@ -590,6 +1130,7 @@ LFHashTable<K, V, KC, HashFn, VC, A, KM, VM>::LFHashTable(size_t initialSize, do
     , m_TablesCreated(0)
     , m_TablesDeleted(0)
 #endif
+    , m_Migration(this)
 {
     assert(m_Density > 1e-9);
     assert(m_Density < 1.);
@@ -597,12 +1138,14 @@ LFHashTable<K, V, KC, HashFn, VC, A, KM, VM>::LFHashTable(size_t initialSize, do
     m_Head = CreateTable(this, initialSize/m_Density);
 }
 
-template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-LFHashTable<K, V, KC, HF, VC, A, KM, VM>::LFHashTable(const LFHashTable& other)
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::LFHashTable(const LFHashTable& other)
     : m_Density(other.m_Density)
+    , m_ReservedCnt(other.m_ReservedCnt)
     , m_Hash(other.m_Hash)
     , m_KeysAreEqual(other.m_KeysAreEqual)
     , m_ValuesAreEqual(other.m_ValuesAreEqual)
+    , m_FileNumber(0)
     , m_Head(this)
     , m_HeadToDelete(this)
     , GuardManager(this)
@@ -614,10 +1157,12 @@ LFHashTable<K, V, KC, HF, VC, A, KM, VM>::LFHashTable(const LFHashTable& other)
     , m_TablesCreated(0)
     , m_TablesDeleted(0)
 #endif
+    , m_Migration(this)
 {
 #ifdef TRACE
     Trace(Cerr, "TLFHashTable copy constructor called\n");
 #endif
+    m_CopyPacer.SetBudget(other.m_CopyPacer.Budget());
     m_Head = CreateTable(this, Max((size_t)1, other.Size()) / m_Density);
     PutAllFrom(other);
 #ifdef TRACE
@@ -625,10 +1170,20 @@ LFHashTable<K, V, KC, HF, VC, A, KM, VM>::LFHashTable(const LFHashTable& other)
 #endif
 }
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::~LFHashTable()
+{
+    // workers must not change tables, which are saved or deleted
+    m_Migration.Stop();
+    // files stay in page cache, so the next Open needs counters only
+    if (!m_Directory.empty())
+        SaveCounters(true);
+}
+
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
 template <bool ShouldSetGuard>
-typename LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::Value
-LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::GetImpl(const Key& key, SearchHint* hint) {
+typename LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::Value
+LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::GetImpl(const Key& key, SearchHint* hint) {
     assert(!m_KeysAreEqual(key, KeyNone()));
 #ifdef TRACE
     Trace(Cerr, "TLFHashTable.Get(%s)\n", ~KeyToString(key));
@@ -669,43 +1224,95 @@ LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::GetImpl(const Key& key, SearchHint*
     Cerr << headLen << " " << deleteLen << Endl;
 #endif
 
-    if (EXPECT_FALSE(m_Head->GetNext()))
-        m_Head->DoCopyTask();
+    HelpCopying();
 
-    const size_t hashValue = m_Hash(key);
-    Value returnValue;
-    Table* cur = m_Head;
-    do
+    Value returnValue = GetFromTables(key, m_Hash(key), hint);
+
+    if (ShouldSetGuard)
+    {
+        StopGuarding();
+        m_Guard = lastGuard;
+    }
+
+#ifdef TRACE
+    Trace(Cerr, "Get returns %s\n", ~ValueToString(returnValue));
+#endif
+    return returnValue;
+}
+
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+inline typename LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::Value
+LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::GetFromTables(const Key& key, size_t hashValue, SearchHint* hint) {
+    return NLFHT::TableOperations<Self>::Get(*this, m_Head, key, hashValue, hint);
+}
+
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+template <bool ShouldSetGuard>
+void LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
+GetManyImpl(const Key* keys, size_t n, Value* values, SearchHint* hint) {
+    Guard* lastGuard;
+    if (ShouldSetGuard)
+    {
+        lastGuard = m_Guard;
+        StartGuarding(hint);
+        OnGet();
+    }
+
+    HelpCopying();
+
+    // hashes of keys from i to i + DISTANCE, key i + DISTANCE is prefetched,
+    // when key i is looked up; prefetches go to head only, older tables are
+    // rare and small
+    static const size_t DISTANCE = P::PREFETCH_DISTANCE;
+    size_t hashes[DISTANCE + 1];
+    Table* head = m_Head;
+    for (size_t i = 0; i < n && i < DISTANCE; ++i)
+    {
+        hashes[i] = m_Hash(keys[i]);
+        head->Prefetch(hashes[i]);
+    }
+    for (size_t i = 0; i < n; ++i)
     {
-        if (cur->Get(key, hashValue, returnValue, hint))
+        if (i + DISTANCE < n)
         {
-            break;
+            const size_t hashValue = m_Hash(keys[i + DISTANCE]);
+            hashes[(i + DISTANCE) % (DISTANCE + 1)] = hashValue;
+            head->Prefetch(hashValue);
         }
-        cur = cur->GetNext();
+        assert(!m_KeysAreEqual(keys[i], KeyNone()));
+        values[i] = GetFromTables(keys[i], hashes[i % (DISTANCE + 1)], hint);
     }
-    while (cur);
 
-    if (!cur || EXPECT_FALSE(m_ValuesAreEqual(returnValue, ValueBaby())))
+    if (ShouldSetGuard)
     {
-        returnValue = NotFound();
+        StopGuarding();
+        m_Guard = lastGuard;
     }
+}
+
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+template <bool ShouldSetGuard>
+void LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::PrefetchImpl(const Key& key, SearchHint* hint) {
+    Guard* lastGuard;
+    if (ShouldSetGuard)
+    {
+        lastGuard = m_Guard;
+        StartGuarding(hint);
+    }
+
+    m_Head->Prefetch(m_Hash(key));
 
     if (ShouldSetGuard)
     {
         StopGuarding();
         m_Guard = lastGuard;
     }
-
-#ifdef TRACE
-    Trace(Cerr, "Get returns %s\n", ~ValueToString(returnValue));
-#endif
-    return returnValue;
 }
 
 // returns true if new key appeared in a table
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
 template <bool ShouldSetGuard, bool ShouldDeleteKey>
-bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::
+bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
 PutImpl(const Key& key, const Value& value, const PutCondition& cond, SearchHint* hint)
 {
     assert(THTValueTraits::IsGood(value));
@@ -724,157 +1331,247 @@ PutImpl(const Key& key, const Value& value, const PutCondition& cond, SearchHint
         OnPut();
     }
 
-    if (EXPECT_FALSE(m_Head->GetNext()))
-    {
-        m_Head->DoCopyTask();
-    }
+    HelpCopying();
 
-    typename Table::EResult result;
-    bool keyInstalled;
+    const bool result = PutToTables<ShouldDeleteKey>(key, m_Hash(key), value, cond);
 
-    Table* cur = m_Head;
-    size_t cnt = 0;
-    while (true)
+    if (ShouldSetGuard)
     {
-        if (++cnt >= 100000)
-        {
-            VERIFY(false, "Too long table list\n");
-        }
-        if ((result = cur->Put(key, value, cond, keyInstalled)) != Table::FULL_TABLE)
-        {
-            break;
-        }
-        if (!cur->GetNext())
-        {
-            cur->CreateNext();
-        }
-        cur = cur->GetNext();
+        StopGuarding();
+        m_Guard = lastGuard;
     }
 
-    if (ShouldDeleteKey && !keyInstalled)
-    {
-        UnRefKey(key);
-    }
-    if (result == Table::FAILED)
+    TryToDelete();
+
+    return result;
+}
+
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+template <bool ShouldDeleteKey>
+inline bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
+PutToTables(const Key& key, size_t hashValue, const Value& value, const PutCondition& cond)
+{
+    const typename Table::EResult result =
+        NLFHT::TableOperations<Self>::template Put<ShouldDeleteKey>(*this, m_Head, key, hashValue, value, cond);
+    // deletes don't own keys
+    if (!ShouldDeleteKey && P::COMPACTION_RATIO && result == Table::SUCCEEDED &&
+        EXPECT_FALSE(m_Guard->CountDelete(COMPACTION_CHECK_PERIOD)))
     {
-        UnRefValue(value);
+        CompactIfSparse();
     }
 
-    if (ShouldSetGuard)
+    return result == Table::SUCCEEDED;
+}
+
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+template <bool ShouldDeleteKey>
+void LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
+PutManyImpl(const Key* keys, const Value* values, size_t n, const PutCondition& cond,
+            bool* results, SearchHint* hint)
+{
     {
-        StopGuarding();
-        m_Guard = lastGuard;
+        // guard is released also when scratch vectors or next tables can't be allocated
+        NLFHT::Guarding<Self> guarding(*this, hint);
+        OnPut();
+
+        HelpCopying();
+
+        // radix partition of batch by home entry in head table,
+        // stable, so repeated keys keep batch order
+        static const size_t RADIX = 256;
+        Table* head = m_Head;
+        const size_t headSize = head->m_Size;
+        std::vector<size_t> hashes(n);
+        std::vector<uint8_t> parts(n);
+        size_t partStart[RADIX + 1] = {};
+        for (size_t i = 0; i < n; ++i)
+        {
+            assert(!m_KeysAreEqual(keys[i], KeyNone()));
+            hashes[i] = m_Hash(keys[i]);
+            parts[i] = (uint8_t)((unsigned __int128)head->HomeIndex(hashes[i]) * RADIX / headSize);
+            ++partStart[parts[i] + 1];
+        }
+        for (size_t p = 0; p < RADIX; ++p)
+            partStart[p + 1] += partStart[p];
+        std::vector<size_t> order(n);
+        for (size_t i = 0; i < n; ++i)
+            order[partStart[parts[i]]++] = i;
+
+        // home entry of key DISTANCE positions ahead is prefetched
+        static const size_t DISTANCE = P::PREFETCH_DISTANCE;
+        for (size_t j = 0; j < n && j < DISTANCE; ++j)
+            head->Prefetch(hashes[order[j]]);
+        for (size_t j = 0; j < n; ++j)
+        {
+            if (j + DISTANCE < n)
+                head->Prefetch(hashes[order[j + DISTANCE]]);
+            const size_t i = order[j];
+            const Value value = values ? values[i] : ValueNone();
+            assert(THTValueTraits::IsGood(value));
+            const bool result = PutToTables<ShouldDeleteKey>(keys[i], hashes[i], value, cond);
+            if (results)
+                results[i] = result;
+        }
     }
 
     TryToDelete();
-
-    return result == Table::SUCCEEDED;
 }
 
 // hash table access methods
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-typename LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::Value
-LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+typename LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::Value
+LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
 Get(Key key, SearchHint* hint)
 {
     return GetImpl<true>(key, hint);
 }
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-void LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
+GetMany(const Key* keys, size_t n, Value* values, SearchHint* hint)
+{
+    GetManyImpl<true>(keys, n, values, hint);
+}
+
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
+Prefetch(Key key, SearchHint* hint)
+{
+    PrefetchImpl<true>(key, hint);
+}
+
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
 Put(Key key, Value value, SearchHint* hint)
 {
-    PutImpl<true, true>(key, value, PutCondition(PutCondition::IF_MATCHES), hint);
+    PutImpl<true, true>(key, value, PutCondition(), hint);
 }
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
 PutIfMatch(Key key, Value newValue, Value oldValue, SearchHint* hint)
 {
     return PutImpl<true, true>(key, newValue, PutCondition(PutCondition::IF_MATCHES, oldValue), hint);
 }
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
 PutIfAbsent(Key key, Value value, SearchHint* hint)
 {
     return PutImpl<true, true>(key, value, PutCondition(PutCondition::IF_ABSENT, ValueBaby()), hint);
 }
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
 PutIfExists(Key key, Value newValue, SearchHint* hint)
 {
     return PutImpl<true, true>(key, newValue, PutCondition(PutCondition::IF_EXISTS), hint);
 }
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::Delete(Key key, SearchHint* hint) {
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::Delete(Key key, SearchHint* hint) {
     return PutImpl<true, false>(key, ValueNone(), PutCondition(PutCondition::IF_EXISTS), hint);
 }
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::DeleteIfMatch(Key key, Value oldValue, SearchHint* hint)
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::DeleteIfMatch(Key key, Value oldValue, SearchHint* hint)
 {
     return PutImpl<true, false>(key, ValueNone(), PutCondition(PutCondition::IF_MATCHES, oldValue), hint);
 }
 
+// batch operations
+
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
+PutMany(const Key* keys, const Value* values, size_t n, bool* results, SearchHint* hint)
+{
+    PutManyImpl<true>(keys, values, n, PutCondition(), results, hint);
+}
+
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
+PutIfAbsentMany(const Key* keys, const Value* values, size_t n, bool* results, SearchHint* hint)
+{
+    PutManyImpl<true>(keys, values, n, PutCondition(PutCondition::IF_ABSENT, ValueBaby()), results, hint);
+}
+
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
+DeleteMany(const Key* keys, size_t n, bool* results, SearchHint* hint)
+{
+    PutManyImpl<false>(keys, 0, n, PutCondition(PutCondition::IF_EXISTS), results, hint);
+}
+
 // no guarding
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-typename LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::Value
-LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+typename LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::Value
+LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
 GetNoGuarding(Key key, SearchHint* hint)
 {
     return GetImpl<false>(key, hint);
 }
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-void LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
+GetManyNoGuarding(const Key* keys, size_t n, Value* values, SearchHint* hint)
+{
+    GetManyImpl<false>(keys, n, values, hint);
+}
+
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
+PrefetchNoGuarding(Key key, SearchHint* hint)
+{
+    PrefetchImpl<false>(key, hint);
+}
+
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
 PutNoGuarding(Key key, Value value, SearchHint* hint)
 {
     PutImpl<false, true>(key, value, PutCondition(), hint);
 }
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
 PutIfMatchNoGuarding(Key key, Value newValue, Value oldValue, SearchHint* hint)
 {
     return PutImpl<false, true>(key, newValue, PutCondition(PutCondition::IF_MATCHES, oldValue), hint);
 }
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
 PutIfAbsentNoGuarding(Key key, Value value, SearchHint* hint)
 {
     return PutImpl<false, true>(key, value, PutCondition(PutCondition::IF_ABSENT, ValueBaby()), hint);
 }
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::
 PutIfExistsNoGuarding(Key key, Value newValue, SearchHint* hint)
 {
     return PutImpl<false, true>(key, newValue, PutCondition(PutCondition::IF_EXISTS), hint);
 }
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::DeleteNoGuarding(Key key, SearchHint* hint)
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::DeleteNoGuarding(Key key, SearchHint* hint)
 {
     return PutImpl<false, false>(key, ValueNone(), PutCondition(PutCondition::IF_EXISTS), hint);
 }
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::DeleteIfMatchNoGuarding(Key key, Value oldValue, SearchHint* hint)
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::DeleteIfMatchNoGuarding(Key key, Value oldValue, SearchHint* hint)
 {
     return PutImpl<false, false>(key, ValueNone(), PutCondition(PutCondition::IF_MATCHES, oldValue), hint);
 }
 
 // massive put
 
-template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM>
+template <typename Key, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
 template <class OtherTable>
-void LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::PutAllFrom(const OtherTable& other)
+void LFHashTable<Key, V, KC, HF, VC, A, KM, VM, P>::PutAllFrom(const OtherTable& other)
 {
     TLFHTRegistration registration(*this);
     for (ConstIterator it = other.Begin(); it.IsValid(); ++it)
@@ -887,104 +1584,602 @@ void LFHashTable<Key, V, KC, HF, VC, A, KM, VM>::PutAllFrom(const OtherTable& ot
 
 // how to guarp
 
-template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-inline void LFHashTable<K, V, KC, HF, VC, A, KM, VM>::StartGuarding(SearchHint* hint)
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+inline void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::StartGuarding(SearchHint* hint)
 {
-    if (hint) {
-        if (EXPECT_FALSE(!hint->m_Guard))
-            hint->m_Guard = GuardForTable();
-        m_Guard = hint->m_Guard;
-    } else {
-        m_Guard = GuardForTable();
-    }
-    VERIFY(m_Guard, "Register in table!\n");
-    assert(m_Guard == NLFHT::ThreadGuardTable::ForTable(this));
-    assert(m_Guard->GetThreadId() == CurrentThreadId());
-
-    while (true) {
-        AtomicBase currentTableNumber = m_TableNumber;
-        m_Guard->GuardTable(currentTableNumber);
-        AtomicBarrier();
-        if (EXPECT_TRUE(m_TableNumber == currentTableNumber)) {
-            // Now we are sure, that no thread can delete current Head.
-            return;
-        }
-    }
+    NLFHT::TableOperations<Self>::StartGuarding(*this, hint);
 }
 
-template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-inline void LFHashTable<K, V, KC, HF, VC, A, KM, VM>::StopGuarding()
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+inline void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::StopGuarding()
 {
     assert(m_Guard);
     m_Guard->StopGuarding();
 }
 
-template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-void LFHashTable<K, V, KC, HF, VC, A, KM, VM>::TryToDelete()
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::CopyOldTables()
+{
+    Guard* lastGuard = m_Guard;
+    while (true)
+    {
+        StartGuarding(0);
+        Table* head = m_Head;
+        const bool done = !head->GetNext();
+        bool allTaken = false;
+        if (!done)
+        {
+            head->DoCopyTask(false);
+            allTaken = (size_t)head->m_CopiedCnt >= head->m_Size;
+        }
+        StopGuarding();
+        TryToDelete();
+
+        if (done)
+            break;
+        // head is copied, but it's not thrown away yet
+        // cause other threads are finishing their copy tasks
+        if (allTaken && m_Head == head)
+            sched_yield();
+    }
+    m_Guard = lastGuard;
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::CompactIfSparse()
 {
-    Table* toDel = m_HeadToDelete;
-    if (!toDel)
+    Table* head = m_Head;
+    if (head->GetNext() || head->IsFull())
         return;
-    Table* oldHead = m_Head;
-    AtomicBase firstGuardedTable = m_GuardManager.GetFirstGuardedTable();
+    // key count is zeroed at table creation, so it's keys installed in head;
+    // too few of them means that head was allocated in advance
+    const size_t keyCnt = m_GuardManager.TotalKeyCnt();
+    if (keyCnt < head->m_Size * m_Density / 2)
+        return;
+    const size_t aliveCnt = Max((AtomicBase)0, m_GuardManager.TotalAliveCnt());
+    if (aliveCnt * P::COMPACTION_RATIO > keyCnt)
+        return;
+    head->StartCopying();
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::ShrinkToFit()
+{
+    WaitForMigration();
+    Guard* lastGuard = m_Guard;
+    StartGuarding(0);
+    Table* head = m_Head;
+    if (!head->GetNext())
+        head->StartCopying();
+    StopGuarding();
+    m_Guard = lastGuard;
+    TryToDelete();
+    WaitForMigration();
+}
 
-    // if the following is true, it means that no thread works
-    // with the tables to ToDelete list
-    if (m_TableToDeleteNumber < firstGuardedTable)
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+template <class Fn>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::ParallelForEach(Fn fn, size_t threadCnt)
+{
+    ForEachWorker<Fn> worker;
+    worker.m_Fn = &fn;
+    std::vector< ForEachWorker<Fn> > workers(Max((size_t)1, threadCnt), worker);
+    RunParallelPass(workers);
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+template <class T, class Map, class Combine>
+T LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::
+ParallelReduce(const T& init, Map map, Combine combine, size_t threadCnt)
+{
+    ReduceWorker<T, Map, Combine> worker;
+    worker.m_Result = init;
+    worker.m_Map = &map;
+    worker.m_Combine = &combine;
+    std::vector< ReduceWorker<T, Map, Combine> > workers(Max((size_t)1, threadCnt), worker);
+    RunParallelPass(workers);
+
+    T result = init;
+    for (size_t i = 0; i < workers.size(); ++i)
+        result = combine(result, workers[i].m_Result);
+    return result;
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::SaveSnapshot(const std::string& path, size_t threadCnt, bool consistent)
+{
+    static_assert(NLFHT::IsPlainData<K>::value, "snapshot keeps keys raw");
+    static_assert(NLFHT::IsPlainData<V>::value, "snapshot keeps values raw");
+    NLFHT::SnapshotWriter writer(path, sizeof(SnapshotEntry));
+    SnapshotWorker worker;
+    worker.m_Writer = &writer;
+    std::vector<SnapshotWorker> workers(Max((size_t)1, threadCnt), worker);
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].m_Block.reserve(SnapshotWorker::BLOCK_SIZE);
+    // snapshot is checkpoint: later changes go to next delta, the ones, which started
+    // before, are done before freezing or pass, so pass sees them
+    if (P::DIRTY_REGION_BYTES)
     {
-        if (AtomicCas(&m_HeadToDelete, (Table*)0, toDel))
+        Guard* guard = AcquirePassGuard();
+        TakeDirty(0);
+        ReleasePassGuard(guard);
+        WaitForActiveOperations();
+    }
+    if (consistent)
+    {
+        Guard* guard;
+        Table* frozen = FreezeHead(guard);
+        try
         {
-            if (m_Head == oldHead)
-            {
-                while (toDel)
-                {
-                    Table* nextToDel = toDel->m_NextToDelete;
-#ifdef TRACE_MEM
-                    Trace(Cerr, "Deleted table %zd of size %zd\n", (size_t)toDel, toDel->Size);
-#endif
-                    DeleteTable(toDel, true);
-                    toDel = nextToDel;
-                }
-            }
-            else
+            RunParallelPass(workers, frozen);
+        }
+        catch (...)
+        {
+            UnfreezeHead(frozen, guard);
+            throw;
+        }
+        UnfreezeHead(frozen, guard);
+    }
+    else
+    {
+        RunParallelPass(workers);
+    }
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].Flush();
+    writer.Finish();
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::LoadSnapshot(const std::string& path)
+{
+    static_assert(NLFHT::IsPlainData<K>::value, "snapshot keeps keys raw");
+    static_assert(NLFHT::IsPlainData<V>::value, "snapshot keeps values raw");
+    const NLFHT::SnapshotReader reader(path, sizeof(SnapshotEntry));
+    LoadEntries((const SnapshotEntry*)reader.Entries(), reader.Header().m_EntryCnt);
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+template <class E>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::LoadEntries(const E* entries, size_t entryCnt)
+{
+    WaitForMigration();
+    {
+        // guard is released also when new table can't be allocated
+        NLFHT::Guarding<Self> guarding(*this, 0);
+        Table* head = m_Head;
+        VERIFY(SizeApprox() == 0 && !head->GetNext(), "Entries are loaded into empty table only\n");
+
+        const size_t aliveCnt = Max(Max((size_t)1, entryCnt), (size_t)m_ReservedCnt);
+        Table* next = CreateTable(this, (size_t)ceil(aliveCnt * (1. / m_Density)));
+        size_t keyCnt = 0;
+        for (size_t i = 0; i < entryCnt; ++i)
+            keyCnt += next->PutNew(entries[i].m_Key, entries[i].m_Value);
+
+        // empty head is thrown away as copied one
+        head->m_Lock.Acquire();
+        head->m_IsFullFlag = true;
+        m_GuardManager.ZeroKeyCnt();
+        head->SetNext(next);
+        head->m_Lock.Release();
+        m_Guard->AddCnt(keyCnt, keyCnt);
+        ThrowAway(head);
+    }
+    TryToDelete();
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+template <class Worker>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::RunParallelPass(std::vector<Worker>& workers, Table* frozen)
+{
+    ParallelPass pass;
+    pass.m_Guard = AcquirePassGuard();
+    pass.m_Frozen = frozen != 0;
+    // tables created later get only keys, put during pass
+    for (Table* cur = frozen ? frozen : (Table*)m_Head; cur; cur = frozen ? 0 : cur->GetNext())
+    {
+        pass.m_Tables.push_back(cur);
+        const size_t chunkCnt = (cur->m_Size + PASS_CHUNK_SIZE - 1) / PASS_CHUNK_SIZE;
+        pass.m_ChunkEnd.push_back((pass.m_ChunkEnd.empty() ? 0 : pass.m_ChunkEnd.back()) + chunkCnt);
+    }
+    pass.m_NextChunk = 0;
+
+    std::vector<std::thread> threads;
+    Guard* lastGuard = m_Guard;
+    try
+    {
+        // reserved, so started thread is always stored and joined
+        threads.reserve(workers.size() - 1);
+        for (size_t i = 1; i < workers.size(); ++i)
+            threads.push_back(std::thread(&LFHashTable::DoParallelPassRegistered<Worker>, this,
+                                          std::ref(pass), std::ref(workers[i])));
+        DoParallelPass(pass, workers[0]);
+    }
+    catch (...)
+    {
+        // worker may throw in the middle of DoParallelPass;
+        // started threads take no more chunks, pass guard outlives them
+        m_Guard = lastGuard;
+        pass.m_NextChunk = pass.m_ChunkEnd.back();
+        for (size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+        ReleasePassGuard(pass.m_Guard);
+        throw;
+    }
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+
+    ReleasePassGuard(pass.m_Guard);
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+template <class Worker>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::DoParallelPass(ParallelPass& pass, Worker& worker)
+{
+    // lookups in tables account statistics in guard of operation
+    Guard* lastGuard = m_Guard;
+    m_Guard = pass.m_Guard;
+    const size_t chunkCnt = pass.m_ChunkEnd.back();
+    Table* first = pass.m_Tables[0];
+    Key key;
+    Value value;
+    while (true)
+    {
+        const size_t chunk = AtomicIncrement(pass.m_NextChunk) - 1;
+        if (chunk >= chunkCnt)
+            break;
+        const size_t tableIndex = std::upper_bound(pass.m_ChunkEnd.begin(), pass.m_ChunkEnd.end(), chunk) -
+                                  pass.m_ChunkEnd.begin();
+        Table* table = pass.m_Tables[tableIndex];
+        const size_t begin = (chunk - (tableIndex ? pass.m_ChunkEnd[tableIndex - 1] : 0)) * PASS_CHUNK_SIZE;
+        const size_t end = Min(table->m_Size, begin + PASS_CHUNK_SIZE);
+        if (pass.m_Frozen)
+        {
+            for (size_t i = begin; i < end; ++i)
+                if (table->GetFrozenEntry(i, key, value))
+                    worker(key, value);
+            continue;
+        }
+        for (size_t i = table->NextToVisit(begin); i < end; i = table->NextToVisit(i + 1))
+            if (table->GetAliveEntry(i, first, key, value))
+                worker(key, value);
+    }
+    m_Guard = lastGuard;
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+typename LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::Table*
+LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::FreezeHead(Guard*& guard)
+{
+    // head without next one, which nobody else freezes;
+    // concurrent point-in-time passes take turns
+    while (true)
+    {
+        WaitForMigration();
+        guard = AcquirePassGuard();
+        Table* head = m_Head;
+        void* frozenValues;
+        try
+        {
+            frozenValues = P::Memory::Allocate(Table::FrozenBytes(head->m_Size));
+        }
+        catch (...)
+        {
+            ReleasePassGuard(guard);
+            throw;
+        }
+        head->m_Lock.Acquire();
+        const bool canFreeze = !head->m_Next && !head->m_FrozenValues;
+        // the same thread would wait for itself forever
+        const bool frozenByMe = head->m_FrozenValues && head->m_FrozenBy == CurrentThreadId() &&
+                                head->m_FrozenByProcess == getpid();
+        if (canFreeze)
+        {
+            head->m_FrozenValues = (Value*)frozenValues;
+            head->m_FrozenBy = CurrentThreadId();
+            head->m_FrozenByProcess = getpid();
+        }
+        head->m_Lock.Release();
+        if (canFreeze)
+        {
+            // operations, started later, save values before changing them
+            AtomicBarrier();
+            return head;
+        }
+        P::Memory::Deallocate(frozenValues, Table::FrozenBytes(head->m_Size));
+        ReleasePassGuard(guard);
+        if (frozenByMe)
+            throw std::logic_error("LFHashTable: nested point-in-time pass of the same thread");
+        sched_yield();
+    }
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::UnfreezeHead(Table* frozen, Guard* guard)
+{
+    frozen->m_Lock.Acquire();
+    Value* frozenValues = frozen->m_FrozenValues;
+    frozen->m_FrozenValues = 0;
+    frozen->m_Lock.Release();
+    // operations, which saw frozen values, may still save them
+    WaitForActiveOperations();
+    P::Memory::Deallocate(frozenValues, Table::FrozenBytes(frozen->m_Size));
+    ReleasePassGuard(guard);
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::WaitForActiveOperations()
+{
+    m_GuardManager.WaitForActiveOperations();
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::TakeDirty(std::vector<DirtyWord>* dirty)
+{
+    for (Table* cur = m_Head; cur; cur = cur->GetNext())
+        for (size_t word = 0; word < Table::DirtyWordCnt(cur->m_Size); ++word)
+        {
+            const AtomicBase bits = cur->TakeDirtyWord(word);
+            if (bits && dirty)
             {
-                // This is handling of possible ABA problem.
-                // If some other table was removed from list,
-                // successfull CAS doesn't guarantee that we have
-                // the same table as before. We put all the elements back
-                // to the ToDelete list.
-                Table* head = toDel;
-                Table* tail = head;
-                while (tail->m_NextToDelete)
-                {
-                    tail = tail->m_NextToDelete;
-                }
-
-                while (true)
-                {
-                    Table* oldToDelete = m_HeadToDelete;
-                    tail->m_NextToDelete = oldToDelete;
-                    if (AtomicCas(&m_HeadToDelete, head, oldToDelete))
-                    {
-                        break;
-                    }
-                }
+                const DirtyWord dirtyWord = {cur, word, bits};
+                dirty->push_back(dirtyWord);
             }
         }
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::WriteDelta(const std::string& path)
+{
+    static_assert(NLFHT::IsPlainData<K>::value, "delta keeps keys raw");
+    static_assert(NLFHT::IsPlainData<V>::value, "delta keeps values raw");
+    VERIFY(P::DIRTY_REGION_BYTES, "Dirty regions are not tracked by policy\n");
+    NLFHT::SnapshotWriter writer(path, sizeof(SnapshotEntry), NLFHT::SnapshotHeader::DELTA);
+    Guard* guard = AcquirePassGuard();
+    std::vector<DirtyWord> dirty;
+    TakeDirty(&dirty);
+    // change, which started before bit was cleared, is done by now,
+    // later ones set bits again
+    WaitForActiveOperations();
+
+    // lookups in tables account statistics in guard of operation
+    Guard* lastGuard = m_Guard;
+    m_Guard = guard;
+    SnapshotWorker worker;
+    worker.m_Writer = &writer;
+    worker.m_Block.reserve(SnapshotWorker::BLOCK_SIZE);
+    Key key;
+    Value value;
+    for (size_t i = 0; i < dirty.size(); ++i)
+    {
+        Table* table = dirty[i].m_Table;
+        for (uint64_t bits = dirty[i].m_Bits; bits; bits &= bits - 1)
+        {
+            size_t begin, end;
+            table->DirtyRegion(dirty[i].m_Word * 64 + __builtin_ctzll(bits), begin, end);
+            for (size_t index = begin; index < end; ++index)
+                if (table->GetDeltaEntry(index, key, value))
+                    worker(key, value);
+        }
+    }
+    worker.Flush();
+    m_Guard = lastGuard;
+
+    try
+    {
+        writer.Finish();
+    }
+    catch (...)
+    {
+        // regions go to next delta
+        for (size_t i = 0; i < dirty.size(); ++i)
+            AtomicOr(dirty[i].m_Table->m_Dirty[dirty[i].m_Word], dirty[i].m_Bits);
+        ReleasePassGuard(guard);
+        throw;
+    }
+    ReleasePassGuard(guard);
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::ApplyDelta(const std::string& path)
+{
+    static_assert(NLFHT::IsPlainData<K>::value, "delta keeps keys raw");
+    static_assert(NLFHT::IsPlainData<V>::value, "delta keeps values raw");
+    const NLFHT::SnapshotReader reader(path, sizeof(SnapshotEntry), NLFHT::SnapshotHeader::DELTA);
+    const size_t entryCnt = reader.Header().m_EntryCnt;
+    const SnapshotEntry* entries = (const SnapshotEntry*)reader.Entries();
+    for (size_t i = 0; i < entryCnt; ++i)
+    {
+        if (m_ValuesAreEqual(entries[i].m_Value, ValueNone()))
+            Delete(entries[i].m_Key);
+        else
+            Put(entries[i].m_Key, entries[i].m_Value);
+    }
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+typename LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::FrozenTable
+LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::Freeze()
+{
+    FrozenTable frozen(m_Hash, m_KeysAreEqual);
+    frozen.Reserve(Size());
+    for (GuardedIterator it(*this); it.IsValid(); ++it)
+        frozen.Add(it.Key(), it.Value());
+    frozen.Build();
+    return frozen;
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::Thaw(const FrozenTable& frozen)
+{
+    LoadEntries(frozen.Entries(), frozen.Size());
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::Open(const std::string& dir)
+{
+    static_assert(!IS_SHARED, "tables in SharedMemory are not files");
+    static_assert(NLFHT::IsPlainData<K>::value, "table files keep keys raw");
+    static_assert(NLFHT::IsPlainData<V>::value, "table files keep values raw");
+    VERIFY(m_Directory.empty() && SizeApprox() == 0 && !m_Head->GetNext() && !m_HeadToDelete,
+           "Open is called for new table only\n");
+
+    const std::vector<uint64_t> numbers = NLFHT::TableFile::List(dir);
+    std::vector<Table*> tables;
+    try
+    {
+        for (size_t i = 0; i < numbers.size(); ++i)
+            tables.push_back(AttachTable(dir, numbers[i]));
+    }
+    catch (...)
+    {
+        for (size_t i = 0; i < tables.size(); ++i)
+        {
+            tables[i]->~Table();
+            NLFHT::TableFile::Close(NLFHT::TableFile::HeaderOf(tables[i]));
+        }
+        throw;
+    }
+
+    // anonymous head is replaced by tables of files
+    const size_t size = m_Head->m_Size;
+    DeleteTable(m_Head);
+    m_Head = 0;
+    m_Directory = dir;
+    if (tables.empty())
+    {
+        m_Head = CreateTable(this, size);
+        return;
+    }
+
+    // all tables but the newest one are full, their copying starts anew:
+    // copying of entry, which is already copied, changes nothing
+    for (size_t i = 0; i + 1 < tables.size(); ++i)
+    {
+        tables[i]->m_IsFullFlag = true;
+        tables[i]->SetNext(tables[i + 1]);
+    }
+    m_FileNumber = numbers.back();
+    m_Head = tables[0];
+
+    Guard* lastGuard = m_Guard;
+    StartGuarding(0);
+    NLFHT::TableFileHeader* header = NLFHT::TableFile::HeaderOf(tables.back());
+    AtomicBase aliveCnt = header->m_AliveCnt;
+    AtomicBase keyCnt = header->m_KeyCnt;
+    // process, which changed table, didn't exit normally
+    if (!header->m_Clean)
+    {
+        aliveCnt = 0;
+        Key key;
+        Value value;
+        for (size_t i = 0; i < tables.size(); ++i)
+            for (size_t index = 0; index < tables[i]->m_Size; ++index)
+                aliveCnt += tables[i]->GetAliveEntry(index, tables[0], key, value);
+        keyCnt = 0;
+        for (typename Table::AllKeysConstIterator it = tables.back()->BeginAllKeys(); it.IsValid(); ++it)
+            ++keyCnt;
+    }
+    header->m_Clean = false;
+    m_Guard->AddCnt(aliveCnt, keyCnt);
+    StopGuarding();
+    m_Guard = lastGuard;
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::Sync()
+{
+    VERIFY(!m_Directory.empty(), "Sync is called for opened table only\n");
+    SaveCounters(true);
+    for (Table* cur = m_Head; cur; cur = cur->GetNext())
+        NLFHT::TableFile::Sync(m_Directory, NLFHT::TableFile::HeaderOf(cur));
+    // counters on disk are right, until table is changed
+    SaveCounters(false);
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::Reserve(size_t n, size_t threadCnt)
+{
+    m_ReservedCnt = n;
+    WaitForMigration();
+    Guard* lastGuard = m_Guard;
+    StartGuarding(0);
+    Table* head = m_Head;
+    const bool shouldGrow = !head->GetNext() && head->m_Size * m_Density < n;
+    if (shouldGrow)
+        head->StartCopying();
+    StopGuarding();
+    m_Guard = lastGuard;
+    TryToDelete();
+    if (!shouldGrow)
+        return;
+
+    std::vector<std::thread> helpers;
+    for (size_t i = 1; i < threadCnt; ++i)
+        helpers.push_back(std::thread(&LFHashTable::CopyOldTablesRegistered, this));
+    WaitForMigration();
+    for (size_t i = 0; i < helpers.size(); ++i)
+        helpers[i].join();
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+double LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::MigrationProgress()
+{
+    Guard* lastGuard = m_Guard;
+    StartGuarding(0);
+    Table* head = m_Head;
+    const double result = head->GetNext() ? Min(1., (double)head->m_CopiedCnt / head->m_Size) : 1.;
+    StopGuarding();
+    m_Guard = lastGuard;
+    return result;
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::WaitForMigration()
+{
+    if (!m_Migration.IsRunning())
+    {
+        CopyOldTables();
+        return;
+    }
+    while (MigrationProgress() < 1.)
+        usleep(100);
+    // progress is 1 when all copy tasks are taken, wait for head to be thrown away
+    while (true)
+    {
+        Guard* lastGuard = m_Guard;
+        StartGuarding(0);
+        const bool done = !m_Head->GetNext();
+        StopGuarding();
+        m_Guard = lastGuard;
+        if (done)
+            break;
+        usleep(100);
+    }
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::ThrowAway(Table* table)
+{
+    AtomicBase currentTableNumber = m_TableNumber;
+    if (m_Head == table && AtomicCas(&m_Head, table->m_Next, table)) {
+        // deleted table from main list
+        // now it's only thread that has pointer to it
+        AtomicIncrement(m_TableNumber);
+        NLFHT::TableOperations<Self>::ScheduleToDelete(*this, table, currentTableNumber);
     }
 }
 
-template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-typename LFHashTable<K, V, KC, HF, VC, A, KM, VM>::ConstIterator
-LFHashTable<K, V, KC, HF, VC, A, KM, VM>::Begin() const
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+typename LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::ConstIterator
+LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::Begin() const
 {
     return ConstIterator(this);
 }
 
 // JUST TO DEBUG
 
-template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-void LFHashTable<K, V, KC, HF, VC, A, KM, VM>::Print(std::ostream& ostr)
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::Print(std::ostream& ostr)
 {
     std::stringstream buf;
     buf << "TLFHashTable printout\n";
@@ -1008,8 +2203,8 @@ void LFHashTable<K, V, KC, HF, VC, A, KM, VM>::Print(std::ostream& ostr)
     ostr << buf.str() << '\n';
 }
 
-template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-size_t LFHashTable<K, V, KC, HF, VC, A, KM, VM>::Size() const
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+size_t LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::SizeByScan() const
 {
     size_t result = 0;
     ConstIterator it = Begin();
@@ -1021,8 +2216,8 @@ size_t LFHashTable<K, V, KC, HF, VC, A, KM, VM>::Size() const
     return result;
 }
 
-template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM>
-void LFHashTable<K, V, KC, HF, VC, A, KM, VM>::Trace(std::ostream& ostr, const char* format, ...)
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>::Trace(std::ostream& ostr, const char* format, ...)
 {
     char buf1[10000];
     sprintf(buf1, "Thread %zd: ", (size_t)&errno);
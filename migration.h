@@ -0,0 +1,259 @@
+#pragma once
+
+#include "atomic.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+#include <time.h>
+
+namespace NLFHT
+{
+    inline uint64_t MonotonicNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    // time, spent by operations in copy tasks, measured with copy budget only;
+    // each guard collects tasks of its thread, guard manager sums them
+    struct CopyStatistics
+    {
+        static const size_t LOG_BUCKETS = 32;
+
+        size_t m_TaskCnt;
+        size_t m_EntryCnt;
+        uint64_t m_TotalNs;
+        uint64_t m_MaxNs;
+        // number of tasks, which took [2^i, 2^(i+1)) ns
+        size_t m_TaskCntByLog[LOG_BUCKETS];
+
+        CopyStatistics()
+            : m_TaskCnt(0)
+            , m_EntryCnt(0)
+            , m_TotalNs(0)
+            , m_MaxNs(0)
+        {
+            for (size_t i = 0; i < LOG_BUCKETS; ++i)
+                m_TaskCntByLog[i] = 0;
+        }
+
+        // by owner thread of guard only
+        inline void Add(size_t entryCnt, uint64_t ns)
+        {
+            ++m_TaskCnt;
+            m_EntryCnt += entryCnt;
+            m_TotalNs += ns;
+            if (m_MaxNs < ns)
+                m_MaxNs = ns;
+            const size_t log = ns ? Min(LOG_BUCKETS - 1, (size_t)(63 - __builtin_clzll(ns))) : 0;
+            ++m_TaskCntByLog[log];
+        }
+        void Merge(const CopyStatistics& other)
+        {
+            m_TaskCnt += other.m_TaskCnt;
+            m_EntryCnt += other.m_EntryCnt;
+            m_TotalNs += other.m_TotalNs;
+            m_MaxNs = Max(m_MaxNs, other.m_MaxNs);
+            for (size_t i = 0; i < LOG_BUCKETS; ++i)
+                m_TaskCntByLog[i] += other.m_TaskCntByLog[i];
+        }
+
+        double NsPerTask() const
+        {
+            return m_TaskCnt ? (double)m_TotalNs / m_TaskCnt : 0.;
+        }
+        double NsPerEntry() const
+        {
+            return m_EntryCnt ? (double)m_TotalNs / m_EntryCnt : 0.;
+        }
+        // upper bound of time of q-quantile of tasks, power of two
+        uint64_t QuantileNs(double q) const
+        {
+            const size_t rank = (size_t)(q * m_TaskCnt);
+            size_t passed = 0;
+            for (size_t i = 0; i < LOG_BUCKETS; ++i)
+            {
+                passed += m_TaskCntByLog[i];
+                if (passed > rank)
+                    return (uint64_t)2 << i;
+            }
+            return m_MaxNs;
+        }
+    };
+
+    // Size of copy task done by an operation.
+    // Without budget task size is fixed by Table::CreateNext.
+    // With budget operation copies as many entries as fit into budget
+    // according to measured time of one entry copy, so resize costs each
+    // operation about budget ns, but lasts longer.
+    // Tasks are timed only with budget, so default copying reads no clock
+    // and writes no shared counters.
+    class CopyPacer : NonCopyable
+    {
+    public:
+        CopyPacer()
+            : m_BudgetNs(0)
+            , m_PsPerEntry(INITIAL_PS_PER_ENTRY)
+        {
+        }
+
+        // zero budget means fixed task size
+        void SetBudget(size_t budgetNs)
+        {
+            m_BudgetNs = budgetNs;
+        }
+        inline size_t Budget() const
+        {
+            return m_BudgetNs;
+        }
+
+        inline size_t TaskSize(size_t fixedSize) const
+        {
+            const size_t budgetNs = m_BudgetNs;
+            if (EXPECT_TRUE(!budgetNs))
+                return fixedSize;
+            return Max((size_t)1, budgetNs * 1000 / Max((size_t)1, (size_t)m_PsPerEntry));
+        }
+
+        // timed task, with budget only
+        void Account(size_t entryCnt, uint64_t ns)
+        {
+            if (!entryCnt)
+                return;
+            // racy moving average, lost updates are fine
+            const AtomicBase sample = (AtomicBase)(ns * 1000 / entryCnt);
+            const AtomicBase old = m_PsPerEntry;
+            m_PsPerEntry = old + (sample - old) / 8;
+        }
+
+    private:
+        // guess before first measurement: copy of entry misses cache in new table
+        static const size_t INITIAL_PS_PER_ENTRY = 50000;
+
+        volatile size_t m_BudgetNs;
+        // moving average of time of one entry copy, in picoseconds
+        Atomic m_PsPerEntry;
+    };
+
+    // Background copying of old tables.
+    // By default every operation, which sees that head table has next one,
+    // copies a chunk of head (Table::DoCopyTask) by itself.
+    // When workers are started, they copy old tables, and operations help
+    // only if copying lags behind: more than 1 + maxLag tables follow the head,
+    // i.e. writes filled the new table before the old one was copied.
+    template <class Prt>
+    class MigrationWorkers : NonCopyable
+    {
+    public:
+        typedef Prt Parent;
+        typedef typename Parent::Table Table;
+
+        MigrationWorkers(Parent* parent)
+            : m_Parent(parent)
+            , m_MaxLag(0)
+            , m_IsRunning(false)
+            , m_Stop(false)
+            , m_Generation(0)
+        {
+        }
+
+        ~MigrationWorkers()
+        {
+            Stop();
+        }
+
+        void Start(size_t threadCnt, size_t maxLag)
+        {
+            Stop();
+            if (!threadCnt)
+                return;
+            m_MaxLag = maxLag;
+            m_Stop = false;
+            m_IsRunning = true;
+            for (size_t i = 0; i < threadCnt; ++i)
+                m_Threads.push_back(std::thread(&MigrationWorkers::Run, this));
+            // copying could start before workers
+            Notify();
+        }
+
+        void Stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_Lock);
+                m_Stop = true;
+            }
+            m_Condition.notify_all();
+            for (size_t i = 0; i < m_Threads.size(); ++i)
+                m_Threads[i].join();
+            m_Threads.clear();
+            m_IsRunning = false;
+        }
+
+        inline bool IsRunning() const
+        {
+            return m_IsRunning;
+        }
+
+        // called under guard by operation, which sees that head has next table
+        inline bool ShouldHelp(const Table* head) const
+        {
+            if (EXPECT_TRUE(!m_IsRunning))
+                return true;
+            size_t lag = 0;
+            for (const Table* cur = head->GetNext()->GetNext(); cur; cur = cur->GetNext())
+                if (++lag > m_MaxLag)
+                    return true;
+            return false;
+        }
+
+        // new table was created, there is a job for workers
+        void Notify()
+        {
+            if (!m_IsRunning)
+                return;
+            {
+                std::lock_guard<std::mutex> lock(m_Lock);
+                ++m_Generation;
+            }
+            m_Condition.notify_all();
+        }
+
+    private:
+        void Run()
+        {
+            m_Parent->RegisterThread();
+            size_t seenGeneration = 0;
+            std::unique_lock<std::mutex> lock(m_Lock);
+            while (true)
+            {
+                while (!m_Stop && seenGeneration == m_Generation)
+                    m_Condition.wait(lock);
+                if (m_Stop)
+                    break;
+                seenGeneration = m_Generation;
+
+                lock.unlock();
+                m_Parent->CopyOldTables();
+                lock.lock();
+            }
+            lock.unlock();
+            m_Parent->ForgetThread();
+        }
+
+    private:
+        Parent* m_Parent;
+        size_t m_MaxLag;
+        volatile bool m_IsRunning;
+
+        std::vector<std::thread> m_Threads;
+        std::mutex m_Lock;
+        std::condition_variable m_Condition;
+        bool m_Stop;
+        size_t m_Generation;
+    };
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include "atomic.h"
+#include "guards.h"
+
+namespace NLFHT
+{
+    // Parts of operations, which are the same in LFHashTable and SegmentedHashTable.
+    // Keys of table Prt live in chains of tables: head of chain is found by structure
+    // of Prt (list head or directory), the next ones by Table::GetNext. Tables, thrown
+    // away from structure, wait in HeadToDelete list, till no guard can see them:
+    // guard keeps number of structure, which was current when operation started.
+    template <class Prt>
+    class TableOperations
+    {
+    public:
+        typedef typename Prt::Table Table;
+        typedef typename Prt::Key Key;
+        typedef typename Prt::Value Value;
+        typedef typename Prt::Guard Guard;
+        typedef typename Prt::SearchHint SearchHint;
+        typedef typename Prt::PutCondition PutCondition;
+
+        static void RegisterThread(Prt& parent)
+        {
+            ThreadGuardTable::RegisterTable(&parent);
+            parent.m_KeyManager.RegisterThread();
+            parent.m_ValueManager.RegisterThread();
+        }
+        static void ForgetThread(Prt& parent)
+        {
+            parent.m_ValueManager.ForgetThread();
+            parent.m_KeyManager.ForgetThread();
+            ThreadGuardTable::ForgetTable(&parent);
+        }
+
+        static inline void StartGuarding(Prt& parent, SearchHint* hint)
+        {
+            if (hint) {
+                if (EXPECT_FALSE(!hint->m_Guard))
+                    hint->m_Guard = GuardForTable(parent);
+                Prt::m_Guard = hint->m_Guard;
+            } else {
+                Prt::m_Guard = GuardForTable(parent);
+            }
+            Guard* guard = Prt::m_Guard;
+            VERIFY(guard, "Register in table!\n");
+            assert(guard == ThreadGuardTable::ForTable(&parent));
+            assert(guard->GetThreadId() == CurrentThreadId());
+
+            while (true) {
+                AtomicBase currentTableNumber = parent.m_TableNumber;
+                guard->GuardTable(currentTableNumber);
+                AtomicBarrier();
+                if (EXPECT_TRUE(parent.m_TableNumber == currentTableNumber)) {
+                    // Now we are sure, that no thread can delete tables of current structure.
+                    return;
+                }
+            }
+        }
+
+        // chain starts from head of key
+        static inline Value Get(Prt& parent, Table* head, const Key& key, size_t hashValue, SearchHint* hint)
+        {
+            Value returnValue;
+            Table* cur = head;
+            do
+            {
+                if (cur->Get(key, hashValue, returnValue, hint))
+                {
+                    break;
+                }
+                cur = cur->GetNext(hashValue);
+            }
+            while (cur);
+
+            if (!cur || EXPECT_FALSE(parent.m_ValuesAreEqual(returnValue, Prt::ValueBaby())))
+            {
+                returnValue = Prt::NotFound();
+            }
+            return returnValue;
+        }
+
+        // puts to the first table of chain, which isn't full, creates next tables
+        // of full one; references, which didn't get into table, are released
+        template <bool ShouldDeleteKey>
+        static inline typename Table::EResult Put(Prt& parent, Table* head, const Key& key, size_t hashValue,
+                                                  const Value& value, const PutCondition& cond)
+        {
+            typename Table::EResult result;
+            bool keyInstalled = false;
+
+            Table* cur = head;
+            size_t cnt = 0;
+            try
+            {
+                while (true)
+                {
+                    if (++cnt >= 100000)
+                    {
+                        VERIFY(false, "Too long table list\n");
+                    }
+                    if ((result = cur->Put(key, hashValue, value, cond, keyInstalled)) != Table::FULL_TABLE)
+                    {
+                        break;
+                    }
+                    if (!cur->GetNext())
+                    {
+                        cur->CreateNext();
+                    }
+                    cur = cur->GetNext(hashValue);
+                }
+            }
+            catch (...)
+            {
+                // next tables can't be created, value isn't in table
+                result = Table::FAILED;
+                ReleaseRefs<ShouldDeleteKey>(parent, key, value, keyInstalled, result);
+                throw;
+            }
+
+            ReleaseRefs<ShouldDeleteKey>(parent, key, value, keyInstalled, result);
+            return result;
+        }
+
+        // table was in structure with number tableNumber, caller makes the number greater,
+        // so new operations can't find table
+        static void ScheduleToDelete(Prt& parent, Table* table, AtomicBase tableNumber)
+        {
+            parent.m_TableToDeleteNumber = tableNumber;
+            while (true)
+            {
+                Table* toDelete = parent.m_HeadToDelete;
+                table->m_NextToDelete = toDelete;
+                if (AtomicCas(&parent.m_HeadToDelete, table, toDelete))
+                    break;
+            }
+        }
+
+        // deletes scheduled tables, if no guard can see them,
+        // then parent frees the rest of old structure, see Prt::OnTablesDeleted
+        static void TryToDelete(Prt& parent)
+        {
+            const AtomicBase tableNumber = parent.m_TableNumber;
+            Table* toDel = parent.m_HeadToDelete;
+            if (!toDel)
+                return;
+            const AtomicBase firstGuardedTable = parent.m_GuardManager.GetFirstGuardedTable();
+
+            // if the following is true, it means that no thread works
+            // with the tables to ToDelete list
+            if (parent.m_TableToDeleteNumber < firstGuardedTable && AtomicCas(&parent.m_HeadToDelete, (Table*)0, toDel))
+            {
+                // table is scheduled after table number increment, so if number
+                // is the same, nobody scheduled table since toDel was read
+                if (parent.m_TableNumber == tableNumber)
+                {
+                    while (toDel)
+                    {
+                        Table* nextToDel = toDel->m_NextToDelete;
+                        parent.DeleteTable(toDel, true);
+                        toDel = nextToDel;
+                    }
+                    parent.OnTablesDeleted(firstGuardedTable);
+                }
+                else
+                {
+                    // ABA problem: toDel can be deleted and allocated again,
+                    // put all the elements back to the ToDelete list
+                    Table* tail = toDel;
+                    while (tail->m_NextToDelete)
+                    {
+                        tail = tail->m_NextToDelete;
+                    }
+
+                    while (true)
+                    {
+                        Table* oldToDelete = parent.m_HeadToDelete;
+                        tail->m_NextToDelete = oldToDelete;
+                        if (AtomicCas(&parent.m_HeadToDelete, toDel, oldToDelete))
+                        {
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+    private:
+        static Guard* GuardForTable(Prt& parent)
+        {
+            return dynamic_cast<Guard*>(ThreadGuardTable::ForTable(&parent));
+        }
+
+        template <bool ShouldDeleteKey>
+        static inline void ReleaseRefs(Prt& parent, const Key& key, const Value& value,
+                                       bool keyInstalled, typename Table::EResult result)
+        {
+            if (ShouldDeleteKey && !keyInstalled)
+            {
+                parent.UnRefKey(key);
+            }
+            if (result == Table::FAILED)
+            {
+                parent.UnRefValue(value);
+            }
+        }
+    };
+}
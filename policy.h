@@ -0,0 +1,72 @@
+#pragma once
+
+#include "allocators.h"
+#include "probing.h"
+#include "storage.h"
+
+namespace NLFHT
+{
+    // Compile-time knobs of table internals.
+    // To change some of them derive from DefaultTablePolicy and redefine what you need:
+    //
+    //   struct GroupProbingPolicy : NLFHT::DefaultTablePolicy
+    //   {
+    //       typedef NLFHT::GroupProbing Probing;
+    //   };
+    struct DefaultTablePolicy
+    {
+        // how Table::LookUp walks the entries, see probing.h:
+        // LinearProbing, GroupProbing (SIMD over hash tags) or
+        // StoredHashProbing (for keys with expensive comparator)
+        typedef LinearProbing Probing;
+
+        // how entries are laid out in memory, see storage.h:
+        // EntryArrayStorage (key and value side by side) or
+        // SplitArrayStorage (separate arrays of keys and values)
+        typedef EntryArrayStorage Storage;
+
+        // where entries are allocated, see allocators.h:
+        // AlignedMemory (heap), HugePageMemory<Populate> (mmap with huge pages)
+        // or SharedMemory (region shared by forked processes)
+        typedef AlignedMemory Memory;
+
+        // number of entries in bucket, must be power of two;
+        // probing starts from the first entry of home bucket, entries are
+        // aligned to cache line, so CACHE_LINE_SIZE / sizeof(Entry) makes
+        // bucket exactly one cache line
+        static const size_t BUCKET_SIZE = 1;
+
+        // store entries so that all-zero entry is empty (see storage.h),
+        // then new table memory needs no initialization pass
+        static const bool ZERO_IS_EMPTY = false;
+
+        // size tables exactly instead of rounding up to power of two;
+        // home entry is found by multiply-shift of hash, so all 64 bits
+        // of hash must be well mixed
+        static const bool EXACT_SIZE = false;
+
+        // LFHashTable::GetMany prefetches home entry of key
+        // that many keys before looking it up, must be positive
+        static const size_t PREFETCH_DISTANCE = 8;
+
+        // SegmentedHashTable only: number of entries in segment,
+        // full segment is split into two new ones of the same size
+        static const size_t SEGMENT_SIZE = 1 << 16;
+
+        // LFHashTable only: table, in which keys are installed COMPACTION_RATIO
+        // times more than alive, is copied to new one sized by alive keys,
+        // so tombstones are dropped and table shrinks; 0 disables
+        static const size_t COMPACTION_RATIO = 4;
+
+        // keep bit per entry, set while entry may hold alive value;
+        // iterators skip words of zero bits, which pays off in sparse tables,
+        // but every change of entry liveness is one more atomic operation
+        static const bool OCCUPANCY_BITMAP = false;
+
+        // LFHashTable only: bit per DIRTY_REGION_BYTES of entries, set by writes
+        // and cleared by checkpoints, so WriteDelta writes only changed regions;
+        // deleted keys of dirty regions are copied to new tables till checkpoint;
+        // 0 disables tracking
+        static const size_t DIRTY_REGION_BYTES = 0;
+    };
+}
@@ -0,0 +1,376 @@
+#pragma once
+
+#include "atomic.h"
+
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#elif defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
+
+namespace NLFHT
+{
+    // Probing engines define how Table::LookUp walks the entries.
+    // Each engine is a tag class with nested Engine<Table> template,
+    // which is instantiated once per table. Per-table metadata (if any) trails
+    // entries in the table allocation, so it is zero-filled as entries are,
+    // shared and kept in file as they are, and is written by plain volatile stores.
+    //
+    // Engine contract:
+    //   Bytes(size)                  - size of metadata for size entries (static)
+    //   Init(size, metadata)         - called once after table is allocated, metadata
+    //                                  is zero-filled or kept from file of table
+    //   OnKeyInstalled(index, hash)  - called after successful CAS of key into entry
+    //   HashOf(index, key)           - hash of key installed in entry index
+    //   Prefetch(hash)               - starts loading of memory, that Find(.., hash, ..) reads first
+    //   Find(key, hash, foundKey, probeCnt)
+    //                                - returns index of entry with key or first empty entry,
+    //                                  Table::NO_ENTRY if table has no such entries;
+    //                                  probeCnt is set to table size minus
+    //                                  number of entries passed before returned one
+
+    // plain linear probing, one entry per step
+    class LinearProbing
+    {
+    public:
+        // engine and its metadata layout in table files
+        static const uint32_t LAYOUT = 1;
+
+        template <class TableT>
+        class Engine : NonCopyable
+        {
+        public:
+            typedef typename TableT::Key Key;
+
+            Engine(TableT* table)
+                : m_Table(table)
+            {
+            }
+
+            static size_t Bytes(size_t)
+            {
+                return 0;
+            }
+
+            inline void Init(size_t, void*)
+            {
+            }
+
+            inline void OnKeyInstalled(size_t, size_t)
+            {
+            }
+
+            inline size_t HashOf(size_t, Key key) const
+            {
+                return m_Table->Hash(key);
+            }
+
+            inline void Prefetch(size_t hash) const
+            {
+                PREFETCH_FOR_READ(m_Table->m_Data.KeyAddress(m_Table->HomeIndex(hash)));
+            }
+
+            inline size_t Find(Key key, size_t hash, Key& foundKey, AtomicBase& probeCnt)
+            {
+                const size_t size = m_Table->m_Size;
+                size_t i = m_Table->HomeIndex(hash);
+                probeCnt = size;
+
+                do {
+                    const Key entryKey(m_Table->m_Data.LoadKey(i));
+
+                    if (m_Table->KeysAreEqual(entryKey, key)) {
+                        foundKey = key;
+                        return i;
+                    }
+                    if (m_Table->KeyIsNone(entryKey)) {
+                        foundKey = TableT::NoneKey();
+                        return i;
+                    }
+
+                    ++i;
+                    if (EXPECT_FALSE(i == size))
+                        i = 0;
+                    --probeCnt;
+                } while (probeCnt);
+
+                foundKey = TableT::NoneKey();
+                return TableT::NO_ENTRY;
+            }
+
+        private:
+            TableT* m_Table;
+        };
+    };
+
+    // Linear probing accelerated with control bytes.
+    // Every entry has a control byte holding 7 bits of key hash with high bit set,
+    // or EMPTY, which is zero, so zero-filled metadata needs no initialization.
+    // Control bytes of a whole group are compared with one SIMD instruction,
+    // keys are compared only for entries with matching tag.
+    //
+    // Control byte is written after key CAS, so EMPTY control byte is only a hint:
+    // the key of such entry is always checked. Non-EMPTY control byte never changes,
+    // cause keys are never removed from table.
+    class GroupProbing
+    {
+    public:
+#if defined(__AVX2__)
+        static const size_t GROUP_SIZE = 32;
+#else
+        static const size_t GROUP_SIZE = 16;
+#endif
+        enum { EMPTY = 0 };
+        // groups of other size probe entries in other order
+        static const uint32_t LAYOUT = 2 | (GROUP_SIZE << 8);
+
+        // 7 bits of hash, not used to find home entry:
+        // high ones for masked home index, low ones for range reduced
+        template <bool ExactSize>
+        static inline uint8_t Tag(size_t hash)
+        {
+            if (ExactSize)
+                return (uint8_t)(hash | 0x80);
+            return (uint8_t)((hash >> (sizeof(size_t) * 8 - 7)) | 0x80);
+        }
+
+        // Control bytes of GROUP_SIZE consecutive entries.
+        // Group must be loaded once and then matched: control bytes change
+        // concurrently, and entry, which became non-EMPTY between two loads,
+        // would be missed by both matches.
+        class Group
+        {
+        public:
+            explicit Group(const uint8_t* ctrl)
+#if defined(__AVX2__)
+                : m_Ctrl(_mm256_loadu_si256((const __m256i*)ctrl))
+#elif defined(__SSE2__)
+                : m_Ctrl(_mm_loadu_si128((const __m128i*)ctrl))
+#endif
+            {
+#if defined(__AVX2__) || defined(__SSE2__)
+                // otherwise compiler is free to load control bytes again for each match
+                __asm__ __volatile__("" : "+x" (m_Ctrl));
+#else
+                for (size_t i = 0; i < GROUP_SIZE; ++i)
+                    m_Ctrl[i] = ((const volatile uint8_t*)ctrl)[i];
+#endif
+            }
+
+            // bit i is set if control byte i equals to tag
+            inline uint32_t Match(uint8_t tag) const
+            {
+#if defined(__AVX2__)
+                return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(m_Ctrl, _mm256_set1_epi8((char)tag)));
+#elif defined(__SSE2__)
+                return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(m_Ctrl, _mm_set1_epi8((char)tag)));
+#else
+                uint32_t result = 0;
+                for (size_t i = 0; i < GROUP_SIZE; ++i)
+                    if (m_Ctrl[i] == tag)
+                        result |= (uint32_t)1 << i;
+                return result;
+#endif
+            }
+
+        private:
+#if defined(__AVX2__)
+            __m256i m_Ctrl;
+#elif defined(__SSE2__)
+            __m128i m_Ctrl;
+#else
+            uint8_t m_Ctrl[GROUP_SIZE];
+#endif
+        };
+
+        template <class TableT>
+        class Engine : NonCopyable
+        {
+        public:
+            typedef typename TableT::Key Key;
+
+            Engine(TableT* table)
+                : m_Table(table)
+                , m_Control(0)
+            {
+            }
+
+            // last GROUP_SIZE - 1 bytes mirror the first ones,
+            // so group starting at any entry can be loaded without wrapping
+            static size_t Bytes(size_t size)
+            {
+                return size + GROUP_SIZE - 1;
+            }
+
+            void Init(size_t, void* metadata)
+            {
+                m_Control = (volatile uint8_t*)metadata;
+            }
+
+            inline void OnKeyInstalled(size_t index, size_t hash)
+            {
+                const uint8_t tag = Tag<TableT::Policy::EXACT_SIZE>(hash);
+                m_Control[index] = tag;
+                if (index < GROUP_SIZE - 1)
+                    m_Control[m_Table->m_Size + index] = tag;
+            }
+
+            inline size_t HashOf(size_t, Key key) const
+            {
+                return m_Table->Hash(key);
+            }
+
+            inline void Prefetch(size_t hash) const
+            {
+                const size_t home = m_Table->HomeIndex(hash);
+                PREFETCH_FOR_READ(&m_Control[home]);
+                PREFETCH_FOR_READ(m_Table->m_Data.KeyAddress(home));
+            }
+
+            inline size_t Find(Key key, size_t hash, Key& foundKey, AtomicBase& probeCnt)
+            {
+                const size_t size = m_Table->m_Size;
+                const uint8_t tag = Tag<TableT::Policy::EXACT_SIZE>(hash);
+                const typename TableT::TData& data = m_Table->m_Data;
+
+                size_t start = m_Table->HomeIndex(hash);
+                for (size_t passed = 0; passed < size; passed += GROUP_SIZE)
+                {
+                    const Group group((const uint8_t*)m_Control + start);
+                    uint32_t candidates = group.Match(tag) | group.Match(EMPTY);
+                    if (size - passed < GROUP_SIZE)
+                        candidates &= ((uint32_t)1 << (size - passed)) - 1;
+
+                    while (candidates)
+                    {
+                        const size_t offset = __builtin_ctz(candidates);
+                        candidates &= candidates - 1;
+
+                        size_t index = start + offset;
+                        if (index >= size)
+                            index -= size;
+                        const Key entryKey(data.LoadKey(index));
+
+                        if (m_Table->KeysAreEqual(entryKey, key)) {
+                            foundKey = key;
+                            probeCnt = size - passed - offset;
+                            return index;
+                        }
+                        if (m_Table->KeyIsNone(entryKey)) {
+                            foundKey = TableT::NoneKey();
+                            probeCnt = size - passed - offset;
+                            return index;
+                        }
+                    }
+
+                    start += GROUP_SIZE;
+                    if (start >= size)
+                        start -= size;
+                }
+
+                foundKey = TableT::NoneKey();
+                probeCnt = 0;
+                return TableT::NO_ENTRY;
+            }
+
+        private:
+            TableT* m_Table;
+            volatile uint8_t* m_Control;
+        };
+    };
+
+    // Linear probing with full key hash stored in side array.
+    // Made for keys with expensive comparator (like const char*):
+    // key is read and compared only if stored hash matches, so most
+    // probe steps touch only dense hash array. Stored hash is also
+    // reused by Copy, so keys are not rehashed during migration.
+    //
+    // Hash is written after key CAS, zero stored hash means "unknown"
+    // and entry key is checked as in LinearProbing.
+    class StoredHashProbing
+    {
+    public:
+        static const uint32_t LAYOUT = 3;
+
+        template <class TableT>
+        class Engine : NonCopyable
+        {
+        public:
+            typedef typename TableT::Key Key;
+
+            Engine(TableT* table)
+                : m_Table(table)
+                , m_Hashes(0)
+            {
+            }
+
+            static size_t Bytes(size_t size)
+            {
+                return size * sizeof(size_t);
+            }
+
+            void Init(size_t, void* metadata)
+            {
+                m_Hashes = (volatile size_t*)metadata;
+            }
+
+            inline void OnKeyInstalled(size_t index, size_t hash)
+            {
+                m_Hashes[index] = hash;
+            }
+
+            inline size_t HashOf(size_t index, Key key) const
+            {
+                const size_t stored = m_Hashes[index];
+                return stored ? stored : m_Table->Hash(key);
+            }
+
+            inline void Prefetch(size_t hash) const
+            {
+                const size_t home = m_Table->HomeIndex(hash);
+                PREFETCH_FOR_READ(&m_Hashes[home]);
+                PREFETCH_FOR_READ(m_Table->m_Data.KeyAddress(home));
+            }
+
+            inline size_t Find(Key key, size_t hash, Key& foundKey, AtomicBase& probeCnt)
+            {
+                const size_t size = m_Table->m_Size;
+                const typename TableT::TData& data = m_Table->m_Data;
+                const volatile size_t* hashes = m_Hashes;
+
+                size_t index = m_Table->HomeIndex(hash);
+                for (size_t passed = 0; passed < size; ++passed)
+                {
+                    const size_t stored = hashes[index];
+                    if (!stored || stored == hash)
+                    {
+                        const Key entryKey(data.LoadKey(index));
+
+                        if (m_Table->KeyIsNone(entryKey)) {
+                            foundKey = TableT::NoneKey();
+                            probeCnt = size - passed;
+                            return index;
+                        }
+                        if (m_Table->KeysAreEqual(entryKey, key)) {
+                            foundKey = key;
+                            probeCnt = size - passed;
+                            return index;
+                        }
+                    }
+
+                    ++index;
+                    if (EXPECT_FALSE(index == size))
+                        index = 0;
+                }
+
+                foundKey = TableT::NoneKey();
+                probeCnt = 0;
+                return TableT::NO_ENTRY;
+            }
+
+        private:
+            TableT* m_Table;
+            volatile size_t* m_Hashes;
+        };
+    };
+}
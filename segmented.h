@@ -0,0 +1,688 @@
+#pragma once
+
+#include "lfht.h"
+
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+namespace NLFHT
+{
+    // Directory of extendible hashing over segments (tables).
+    // Directory of depth D has 2^D slots, slot i points to the head table of keys
+    // with directory bits i. Segment of depth d (d <= D) holds keys, which first d
+    // directory bits are equal to its prefix, and takes 2^(D - d) consecutive slots.
+    // Directory bits follow SKIPPED_BITS highest bits of hash, which are tags
+    // of GroupProbing; home entries in segment are found by low bits of hash.
+    //
+    // Find is lock-free, Init, Replace and FreeRetired must be serialized by caller.
+    // Replace doubles directory, if it can't tell halves of segment apart.
+    // Lagging threads can still read old directory, so it's retired with table
+    // number of the replace and freed, when no guard keeps this number.
+    template <class TableT>
+    class SegmentDirectory : NonCopyable
+    {
+    public:
+        static const size_t SKIPPED_BITS = 7;
+        // directory of 2^20 slots is 8 MB, its segments hold 2^20 * SEGMENT_SIZE
+        // entries; deeper one can be needed only by hash, which doesn't spread keys,
+        // so segments of this depth are not split, they grow as LFHashTable tables
+        static const size_t MAX_DEPTH = 20;
+
+        SegmentDirectory()
+            : m_Current(0)
+            , m_Retired(0)
+        {
+        }
+
+        ~SegmentDirectory()
+        {
+            FreeRetired(std::numeric_limits<AtomicBase>::max());
+            free(m_Current);
+        }
+
+        // first depth directory bits of hash
+        static inline size_t Bits(size_t hash, size_t depth)
+        {
+            return depth ? (hash << SKIPPED_BITS) >> (sizeof(size_t) * 8 - depth) : 0;
+        }
+        // bit of hash, which follows first depth directory bits
+        static inline size_t SplitShift(size_t depth)
+        {
+            return sizeof(size_t) * 8 - SKIPPED_BITS - depth - 1;
+        }
+
+        // segments[i] is segment of depth with prefix i
+        void Init(size_t depth, TableT* const* segments)
+        {
+            assert(!m_Current);
+            Slots* slots = NewSlots(depth);
+            for (size_t i = 0; i < ((size_t)1 << depth); ++i)
+                slots->m_Tables[i] = segments[i];
+            m_Current = slots;
+        }
+
+        inline TableT* Find(size_t hash) const
+        {
+            const Slots* slots = m_Current;
+            return slots->m_Tables[Bits(hash, slots->m_Depth)];
+        }
+        // segment is head table of its keys
+        inline bool Contains(const TableT* segment, size_t depth, size_t prefix) const
+        {
+            const Slots* slots = m_Current;
+            return depth <= slots->m_Depth &&
+                   slots->m_Tables[prefix << (slots->m_Depth - depth)] == segment;
+        }
+
+        // puts next tables of segment instead of it: low one is for keys with
+        // the next directory bit unset, high one (if any) is for the others;
+        // directory can be found by operations, which guard tableNumber
+        void Replace(size_t depth, size_t prefix, TableT* low, TableT* high, AtomicBase tableNumber)
+        {
+            Slots* slots = m_Current;
+            if (high && depth == slots->m_Depth)
+            {
+                VERIFY(depth < MAX_DEPTH, "Directory depth is over limit\n");
+                Slots* doubled = NewSlots(depth + 1);
+                for (size_t i = 0; i < ((size_t)1 << depth); ++i)
+                    doubled->m_Tables[2 * i] = doubled->m_Tables[2 * i + 1] = slots->m_Tables[i];
+                m_Current = doubled;
+                slots->m_RetiredNumber = tableNumber;
+                slots->m_Prev = m_Retired;
+                m_Retired = slots;
+                slots = doubled;
+            }
+
+            const size_t shift = slots->m_Depth - depth;
+            const size_t begin = prefix << shift;
+            const size_t cnt = (size_t)1 << shift;
+            for (size_t i = 0; i < cnt; ++i)
+                slots->m_Tables[begin + i] = (high && i >= cnt / 2) ? high : low;
+        }
+
+        // frees directories, retired with table numbers less than firstGuardedTable
+        void FreeRetired(AtomicBase firstGuardedTable)
+        {
+            // the newest directories are the first ones
+            Slots** link = &m_Retired;
+            while (*link && (*link)->m_RetiredNumber >= firstGuardedTable)
+                link = &(*link)->m_Prev;
+            Slots* retired = *link;
+            *link = 0;
+            while (retired)
+            {
+                Slots* prev = retired->m_Prev;
+                free(retired);
+                retired = prev;
+            }
+        }
+
+        // NOT thread-safe
+        size_t Depth() const
+        {
+            return m_Current->m_Depth;
+        }
+        TableT* Slot(size_t index) const
+        {
+            return m_Current->m_Tables[index];
+        }
+
+    private:
+        struct Slots
+        {
+            size_t m_Depth;
+            // retired directories, the next older one and number, it was retired with
+            Slots* m_Prev;
+            AtomicBase m_RetiredNumber;
+            TableT* volatile m_Tables[1];
+        };
+
+        static Slots* NewSlots(size_t depth)
+        {
+            Slots* slots = (Slots*)malloc(sizeof(Slots) + (((size_t)1 << depth) - 1) * sizeof(TableT*));
+            if (!slots)
+                throw std::bad_alloc();
+            slots->m_Depth = depth;
+            slots->m_Prev = 0;
+            return slots;
+        }
+
+    private:
+        Slots* volatile m_Current;
+        Slots* m_Retired;
+    };
+}
+
+// Lock-free hash table, which grows segment by segment.
+// LFHashTable grows by creating new table for all keys and copying all of them,
+// so at the peak two full tables are alive and every resize is O(n).
+// Here keys are spread by directory (see NLFHT::SegmentDirectory) over tables
+// of Policy::SEGMENT_SIZE entries. Full segment is split into two new ones by the
+// same Table::Copy protocol, as in LFHashTable, the other segments are not touched,
+// so resize costs O(SEGMENT_SIZE) and only two extra segments are alive per splitting one.
+//
+// Template parameters are the same as of LFHashTable. Policy::EXACT_SIZE is not
+// supported: segment home entries must be found by low bits of hash.
+// Segment is split, when 2 * density of its entries (but not more than 0.7) hold keys.
+// Segment of SegmentDirectory::MAX_DEPTH isn't split, it grows as LFHashTable tables,
+// so directory stays within its limit even for hash, which doesn't spread keys.
+template <
+    typename K,
+    typename Val,
+    class KeyCmp = EqualToF<K>,
+    class HashFn = HashF<K>,
+    class ValCmp = EqualToF<Val>,
+    class Alloc = DEFAULT_ALLOCATOR(Val),
+    class KeyMgr = NLFHT::Proxy<NLFHT::DefaultKeyManager>,
+    class ValMgr = NLFHT::Proxy<NLFHT::DefaultValueManager>,
+    class TablePolicy = NLFHT::DefaultTablePolicy
+>
+class SegmentedHashTable : public NLFHT::LFHashTableBase
+{
+public:
+    typedef SegmentedHashTable<K, Val, KeyCmp, HashFn, ValCmp, Alloc, KeyMgr, ValMgr, TablePolicy> Self;
+
+    friend class NLFHT::Guarding<Self>;
+    friend class NLFHT::Table<Self>;
+    friend class NLFHT::TableOperations<Self>;
+
+    typedef K Key;
+    typedef Val Value;
+    typedef KeyCmp KeyComparator;
+    typedef ValCmp ValueComparator;
+    typedef Alloc Allocator;
+    typedef TablePolicy Policy;
+    typedef typename KeyMgr::template TRedirected<Self> KeyManager;
+    typedef typename ValMgr::template TRedirected<Self> ValueManager;
+
+    typedef NLFHT::KeyTraits<Key> HTKeyTraits;
+    typedef NLFHT::ValueTraits<Value> THTValueTraits;
+
+    typedef typename NLFHT::HashFunc<Key, HashFn> HashFunc;
+    typedef typename NLFHT::KeysAreEqual<Key, KeyComparator> KeysAreEqual;
+    typedef typename NLFHT::ValuesAreEqual<Value, ValueComparator> ValuesAreEqual;
+
+    typedef NLFHT::Table<Self> Table;
+    typedef NLFHT::SegmentDirectory<Table> Directory;
+
+    typedef NLFHT::Guard<Self> Guard;
+    typedef NLFHT::GuardManager<Self> GuardManager;
+
+    typedef NLFHT::PutCondition<Value> PutCondition;
+
+    class SearchHint
+    {
+        public:
+            friend class SegmentedHashTable;
+            friend class NLFHT::TableOperations<SegmentedHashTable>;
+
+        public:
+            SearchHint()
+                : m_Guard(0)
+            {
+            }
+
+        private:
+            Guard* m_Guard;
+    };
+
+public:
+    SegmentedHashTable(size_t initialSize = 1, double density = 0.5,
+                       const KeyComparator& keysAreEqual = KeyCmp(),
+                       const HashFn& hash = HashFn(),
+                       const ValueComparator& valuesAreEqual = ValCmp());
+    ~SegmentedHashTable();
+
+    // NotFound value getter to compare with
+    inline static Value NotFound()
+    {
+        return ValueNone();
+    }
+
+    // return NotFound value if there is no such key
+    Value Get(Key key, SearchHint* hint = 0);
+    // returns true if condition was matched
+    void Put(Key key, Value value, SearchHint* hint = 0);
+    bool PutIfMatch(Key key, Value newValue, Value oldValue, SearchHint *hint = 0);
+    bool PutIfAbsent(Key key, Value value, SearchHint* hint = 0);
+    bool PutIfExists(Key key, Value value, SearchHint* hint = 0);
+
+    // returns true if key was really deleted
+    bool Delete(Key key, SearchHint* hint = 0);
+    bool DeleteIfMatch(Key key, Value oldValue, SearchHint* hint = 0);
+
+    // number of alive keys, sum of counters of threads, so it costs O(threads);
+    // exact when there are no concurrent modifications
+    size_t Size() const
+    {
+        return SizeApprox();
+    }
+    // the same sum, can be read during modifications, e.g. by monitoring:
+    // it's approximate then, released guard can be counted twice for a moment
+    size_t SizeApprox() const
+    {
+        return Max((AtomicBase)0, m_GuardManager.TotalAliveCnt());
+    }
+    // JUST TO DEBUG, NOT thread-safe: counts keys by iterating all tables
+    size_t SizeByScan() const;
+    bool Empty() const
+    {
+        return Size() == 0;
+    }
+    // NOT thread-safe, number of head segments
+    size_t SegmentCnt() const;
+    // NOT thread-safe, bytes of all tables, including ones waiting for deletion
+    size_t AllocatedBytes() const;
+
+    // time, which every operation may spend copying splitting segment, in ns,
+    // see LFHashTable::SetCopyBudget
+    void SetCopyBudget(size_t budgetNs)
+    {
+        m_CopyPacer.SetBudget(budgetNs);
+    }
+    NLFHT::CopyStatistics GetCopyStatistics() const
+    {
+        return m_GuardManager.TotalCopyStatistics();
+    }
+
+    virtual void RegisterThread()
+    {
+        NLFHT::TableOperations<Self>::RegisterThread(*this);
+    }
+    virtual void ForgetThread()
+    {
+        NLFHT::TableOperations<Self>::ForgetThread(*this);
+    }
+    virtual NLFHT::BaseGuard* AcquireGuard()
+    {
+        return m_GuardManager.AcquireGuard();
+    }
+
+private:
+    // is used by TTable
+    double m_Density;
+
+    // functors
+    HashFunc m_Hash;
+    KeysAreEqual m_KeysAreEqual;
+    ValuesAreEqual m_ValuesAreEqual;
+
+    // whole table structure
+    Directory m_Directory;
+    // serializes changes of directory, freeing retired ones and scheduling tables to delete
+    SpinLock m_DirectoryLock;
+    Table *volatile m_HeadToDelete;
+
+    // guarding
+    static NLFHT_THREAD_LOCAL Guard* m_Guard;
+    GuardManager m_GuardManager;
+
+    // managers
+    KeyManager m_KeyManager;
+    ValueManager m_ValueManager;
+
+    // incremented each time segment is thrown away from directory
+    Atomic m_TableNumber;
+    // guarded number, tables of HeadToDelete list can be found with
+    Atomic m_TableToDeleteNumber;
+
+#ifndef NDEBUG
+    // TO DEBUG LEAKS
+    Atomic m_TablesCreated;
+    Atomic m_TablesDeleted;
+#endif
+
+    NLFHT::CopyPacer m_CopyPacer;
+
+private:
+    template <bool ShouldDeleteKey>
+    bool PutImpl(const Key& key, const Value& value, const PutCondition& condition, SearchHint* hint);
+
+    // head segment of key, copies chunk of it, if it's splitting
+    inline Table* HeadFor(size_t hashValue)
+    {
+        Table* head = m_Directory.Find(hashValue);
+        if (EXPECT_FALSE(head->GetNext() != 0))
+            head->DoCopyTask();
+        return head;
+    }
+
+    // tables structure, used by Table
+    inline bool IsHead(const Table* table) const
+    {
+        return m_Directory.Contains(table, table->m_Depth, table->m_Prefix);
+    }
+    // called under lock of full table
+    void CreateNextTables(Table* table);
+    // replaces copied segment in directory and schedules its deletion
+    void ThrowAway(Table* table);
+    // segments are copied by operations only
+    inline void OnNextTableCreated()
+    {
+    }
+    inline void IncreaseKeyCnt(Table* table)
+    {
+        AtomicIncrement(table->m_KeyCnt);
+    }
+    inline size_t KeyCnt(const Table* table)
+    {
+        return table->m_KeyCnt;
+    }
+
+    // NOT thread-safe, all tables reachable from directory
+    void CollectTables(std::vector<Table*>& tables) const;
+
+    // thread-safefy and lock-free memory reclamation is done here
+    inline void StartGuarding(SearchHint* hint)
+    {
+        NLFHT::TableOperations<Self>::StartGuarding(*this, hint);
+    }
+    inline void StopGuarding()
+    {
+        assert(m_Guard);
+        m_Guard->StopGuarding();
+    }
+    void TryToDelete()
+    {
+        NLFHT::TableOperations<Self>::TryToDelete(*this);
+    }
+    // directories, retired before deleted tables, can't be found too
+    void OnTablesDeleted(AtomicBase firstGuardedTable)
+    {
+        m_DirectoryLock.Acquire();
+        m_Directory.FreeRetired(firstGuardedTable);
+        m_DirectoryLock.Release();
+    }
+
+    // table header and entries are one block of Policy::Memory
+    Table* CreateSegment(size_t depth, size_t prefix, size_t size)
+    {
+        const size_t allocSize = Table::AllocSize(size);
+        Table* newTable = (Table*)Policy::Memory::Allocate(allocSize);
+        try
+        {
+            new (newTable) Table(this, size);
+            newTable->m_AllocSize = allocSize;
+            newTable->m_Depth = depth;
+            newTable->m_Prefix = prefix;
+            return newTable;
+        }
+        catch (...)
+        {
+            Policy::Memory::Deallocate(newTable, allocSize);
+            throw;
+        }
+    }
+    void DeleteTable(Table* table, bool shouldDeleteKeys = false)
+    {
+        if (shouldDeleteKeys)
+        {
+            for (typename Table::AllKeysConstIterator it = table->BeginAllKeys(); it.IsValid(); ++it)
+            {
+                UnRefKey(it.Key());
+            }
+        }
+        const size_t allocSize = table->m_AllocSize;
+        table->~Table();
+        Policy::Memory::Deallocate(table, allocSize);
+    }
+
+    // traits wrappers
+    static Key KeyNone()
+    {
+        return HTKeyTraits::None();
+    }
+    void UnRefKey(Key key, size_t cnt = 1)
+    {
+        m_KeyManager.UnRef(key, cnt);
+    }
+
+    static Value ValueNone() {
+        return THTValueTraits::None();
+    }
+    static Value ValueBaby() {
+        return THTValueTraits::Baby();
+    }
+    void UnRefValue(Value value, size_t cnt = 1)
+    {
+        m_ValueManager.UnRef(value, cnt);
+    }
+};
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+NLFHT_THREAD_LOCAL NLFHT::Guard< SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P> >* SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::m_Guard((Guard*)0);
+
+template <typename K, typename V, class KC, class HashFn, class VC, class A, class KM, class VM, class P>
+SegmentedHashTable<K, V, KC, HashFn, VC, A, KM, VM, P>::SegmentedHashTable(size_t initialSize, double density,
+                                 const KeyComparator& keysAreEqual,
+                                 const HashFn& hash,
+                                 const ValueComparator& valuesAreEqual)
+    : m_Density(density)
+    , m_Hash(hash)
+    , m_KeysAreEqual(keysAreEqual)
+    , m_ValuesAreEqual(valuesAreEqual)
+    , m_HeadToDelete(0)
+    , m_GuardManager(this)
+    , m_KeyManager(this)
+    , m_ValueManager(this)
+    , m_TableNumber(0)
+    , m_TableToDeleteNumber(std::numeric_limits<AtomicBase>::max())
+#ifndef NDEBUG
+    , m_TablesCreated(0)
+    , m_TablesDeleted(0)
+#endif
+{
+    static_assert(!P::EXACT_SIZE, "segments must find home entries by low bits of hash");
+    static_assert(!NLFHT::IsSharedMemory<typename P::Memory>::value, "directory is allocated in heap of process");
+    assert(m_Density > 1e-9);
+    assert(m_Density < 1.);
+
+    // enough segments for initialSize keys from the start
+    size_t depth = 0;
+    while (((size_t)1 << depth) * P::SEGMENT_SIZE * m_Density < initialSize)
+    {
+        if (depth == Directory::MAX_DEPTH)
+            throw std::length_error("SegmentedHashTable: initial size is over directory limit");
+        ++depth;
+    }
+    std::vector<Table*> segments;
+    for (size_t prefix = 0; prefix < ((size_t)1 << depth); ++prefix)
+        segments.push_back(CreateSegment(depth, prefix, P::SEGMENT_SIZE));
+    m_Directory.Init(depth, &segments[0]);
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::~SegmentedHashTable()
+{
+    std::vector<Table*> tables;
+    CollectTables(tables);
+    for (Table* toDel = m_HeadToDelete; toDel; toDel = toDel->GetNextToDelete())
+        tables.push_back(toDel);
+    for (size_t i = 0; i < tables.size(); ++i)
+        DeleteTable(tables[i]);
+#ifndef NDEBUG
+    if (m_TablesCreated != m_TablesDeleted)
+    {
+        std::cerr << "TablesCreated " << m_TablesCreated << '\n'
+             << "TablesDeleted " << m_TablesDeleted << '\n';
+        VERIFY(false, "Some table lost\n");
+    }
+#endif
+}
+
+// hash table access methods
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+typename SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::Value
+SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::Get(Key key, SearchHint* hint)
+{
+    assert(!m_KeysAreEqual(key, KeyNone()));
+
+    NLFHT::Guarding<Self> guarding(*this, hint);
+    m_Guard->OnGlobalGet();
+
+    const size_t hashValue = m_Hash(key);
+    return NLFHT::TableOperations<Self>::Get(*this, HeadFor(hashValue), key, hashValue, hint);
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+template <bool ShouldDeleteKey>
+bool SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::
+PutImpl(const Key& key, const Value& value, const PutCondition& cond, SearchHint* hint)
+{
+    assert(THTValueTraits::IsGood(value));
+    assert(!m_KeysAreEqual(key, KeyNone()));
+
+    typename Table::EResult result;
+    {
+        NLFHT::Guarding<Self> guarding(*this, hint);
+        m_Guard->OnGlobalPut();
+
+        const size_t hashValue = m_Hash(key);
+        result = NLFHT::TableOperations<Self>::template Put<ShouldDeleteKey>(*this, HeadFor(hashValue), key, hashValue, value, cond);
+    }
+
+    TryToDelete();
+
+    return result == Table::SUCCEEDED;
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::Put(Key key, Value value, SearchHint* hint)
+{
+    PutImpl<true>(key, value, PutCondition(), hint);
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::PutIfMatch(Key key, Value newValue, Value oldValue, SearchHint* hint)
+{
+    return PutImpl<true>(key, newValue, PutCondition(PutCondition::IF_MATCHES, oldValue), hint);
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::PutIfAbsent(Key key, Value value, SearchHint* hint)
+{
+    return PutImpl<true>(key, value, PutCondition(PutCondition::IF_ABSENT, ValueBaby()), hint);
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::PutIfExists(Key key, Value newValue, SearchHint* hint)
+{
+    return PutImpl<true>(key, newValue, PutCondition(PutCondition::IF_EXISTS), hint);
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::Delete(Key key, SearchHint* hint)
+{
+    return PutImpl<false>(key, ValueNone(), PutCondition(PutCondition::IF_EXISTS), hint);
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+bool SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::DeleteIfMatch(Key key, Value oldValue, SearchHint* hint)
+{
+    return PutImpl<false>(key, ValueNone(), PutCondition(PutCondition::IF_MATCHES, oldValue), hint);
+}
+
+// tables structure
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::CreateNextTables(Table* table)
+{
+    const size_t depth = table->m_Depth;
+    const size_t prefix = table->m_Prefix;
+    if (EXPECT_FALSE(depth == Directory::MAX_DEPTH))
+    {
+        // keys of segment have the same directory bits
+        table->SetNext(CreateSegment(depth, prefix, 2 * table->m_Size));
+        return;
+    }
+    Table* low = CreateSegment(depth + 1, prefix << 1, P::SEGMENT_SIZE);
+    Table* high;
+    try
+    {
+        high = CreateSegment(depth + 1, (prefix << 1) | 1, P::SEGMENT_SIZE);
+    }
+    catch (...)
+    {
+        DeleteTable(low);
+        throw;
+    }
+    table->SetNext(low, high, Directory::SplitShift(depth));
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::ThrowAway(Table* table)
+{
+    m_DirectoryLock.Acquire();
+    if (IsHead(table))
+    {
+        // threads, which guard greater number, can't find table and old directory;
+        // under lock numbers of scheduled tables only grow
+        const AtomicBase tableNumber = m_TableNumber;
+        m_Directory.Replace(table->m_Depth, table->m_Prefix, table->GetNext(), table->m_NextHigh, tableNumber);
+        AtomicIncrement(m_TableNumber);
+        NLFHT::TableOperations<Self>::ScheduleToDelete(*this, table, tableNumber);
+    }
+    m_DirectoryLock.Release();
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+void SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::CollectTables(std::vector<Table*>& tables) const
+{
+    const size_t depth = m_Directory.Depth();
+    for (size_t slot = 0; slot < ((size_t)1 << depth); )
+    {
+        Table* head = m_Directory.Slot(slot);
+        slot += (size_t)1 << (depth - head->m_Depth);
+        // head with its next tables, split ones have two
+        const size_t begin = tables.size();
+        tables.push_back(head);
+        for (size_t i = begin; i < tables.size(); ++i)
+        {
+            Table* next = tables[i]->GetNext();
+            Table* nextHigh = tables[i]->m_NextHigh;
+            if (next)
+                tables.push_back(next);
+            if (nextHigh)
+                tables.push_back(nextHigh);
+        }
+    }
+}
+
+// statistics
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+size_t SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::SizeByScan() const
+{
+    std::vector<Table*> tables;
+    CollectTables(tables);
+    size_t result = 0;
+    for (size_t i = 0; i < tables.size(); ++i)
+        for (typename Table::ConstIteratorT it = tables[i]->Begin(); it.IsValid(); ++it)
+            ++result;
+    return result;
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+size_t SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::SegmentCnt() const
+{
+    const size_t depth = m_Directory.Depth();
+    size_t result = 0;
+    for (size_t slot = 0; slot < ((size_t)1 << depth); ++result)
+        slot += (size_t)1 << (depth - m_Directory.Slot(slot)->m_Depth);
+    return result;
+}
+
+template <typename K, typename V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+size_t SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>::AllocatedBytes() const
+{
+    std::vector<Table*> tables;
+    CollectTables(tables);
+    size_t result = 0;
+    for (size_t i = 0; i < tables.size(); ++i)
+        result += tables[i]->m_AllocSize;
+    for (const Table* cur = m_HeadToDelete; cur; cur = cur->GetNextToDelete())
+        result += cur->m_AllocSize;
+    return result;
+}
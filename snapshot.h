@@ -0,0 +1,199 @@
+#pragma once
+
+#include "atomic.h"
+
+#include <stdexcept>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace NLFHT
+{
+    // Snapshot file: header, then entryCnt {key, value} pairs as they are in memory,
+    // so keys and values must be plain data. Delta has the same layout,
+    // None value means, that key was deleted.
+    struct SnapshotHeader
+    {
+        static const uint32_t VERSION = 1;
+
+        enum EKind
+        {
+            FULL,
+            // changes since previous checkpoint
+            DELTA
+        };
+
+        char m_Magic[8];
+        uint32_t m_Version;
+        // sizeof of pair, guards against loading file of other table type
+        uint32_t m_EntrySize;
+        uint64_t m_EntryCnt;
+
+        SnapshotHeader(uint32_t entrySize = 0, uint64_t entryCnt = 0, EKind kind = FULL)
+            : m_Version(VERSION)
+            , m_EntrySize(entrySize)
+            , m_EntryCnt(entryCnt)
+        {
+            memcpy(m_Magic, Magic(kind), sizeof(m_Magic));
+        }
+
+        bool IsValid(uint32_t entrySize, EKind kind) const
+        {
+            return !memcmp(m_Magic, Magic(kind), sizeof(m_Magic)) &&
+                   m_Version == VERSION && m_EntrySize == entrySize;
+        }
+
+        static const char* Magic(EKind kind)
+        {
+            return kind == FULL ? "LFHTSNAP" : "LFHTDLTA";
+        }
+    };
+
+    inline void ThrowSnapshotError(const std::string& path, const char* what)
+    {
+        throw std::runtime_error("snapshot " + path + ": " + what + ": " + strerror(errno));
+    }
+
+    // file being written by several threads, each one appends its own blocks
+    class SnapshotWriter : NonCopyable
+    {
+    public:
+        SnapshotWriter(const std::string& path, size_t entrySize, SnapshotHeader::EKind kind = SnapshotHeader::FULL)
+            : m_Path(path)
+            , m_Kind(kind)
+            , m_EntrySize(entrySize)
+            , m_EntryCnt(0)
+            , m_Failed(false)
+        {
+            m_File = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (m_File < 0)
+                ThrowSnapshotError(m_Path, "open");
+        }
+
+        ~SnapshotWriter()
+        {
+            if (m_File >= 0)
+                close(m_File);
+        }
+
+        // thread-safe: reserves place for entryCnt entries and writes them there
+        void Append(const void* entries, size_t entryCnt)
+        {
+            const size_t offset = AtomicAdd(m_EntryCnt, entryCnt) - entryCnt;
+            if (!Write(entries, entryCnt * m_EntrySize, sizeof(SnapshotHeader) + offset * m_EntrySize))
+                m_Failed = true;
+        }
+
+        // writes header, when all entries are appended
+        void Finish()
+        {
+            if (m_Failed)
+                ThrowSnapshotError(m_Path, "write");
+            const SnapshotHeader header(m_EntrySize, m_EntryCnt, m_Kind);
+            if (!Write(&header, sizeof(header), 0))
+                ThrowSnapshotError(m_Path, "write");
+            if (close(m_File))
+            {
+                m_File = -1;
+                ThrowSnapshotError(m_Path, "close");
+            }
+            m_File = -1;
+        }
+
+        size_t EntryCnt() const
+        {
+            return m_EntryCnt;
+        }
+
+    private:
+        bool Write(const void* data, size_t bytes, size_t offset)
+        {
+            const char* cur = (const char*)data;
+            while (bytes)
+            {
+                const ssize_t written = pwrite(m_File, cur, bytes, offset);
+                if (written < 0 && errno == EINTR)
+                    continue;
+                if (written <= 0)
+                    return false;
+                cur += written;
+                offset += written;
+                bytes -= written;
+            }
+            return true;
+        }
+
+    private:
+        std::string m_Path;
+        SnapshotHeader::EKind m_Kind;
+        int m_File;
+        size_t m_EntrySize;
+        Atomic m_EntryCnt;
+        volatile bool m_Failed;
+    };
+
+    // read-only mapping of snapshot file
+    class SnapshotReader : NonCopyable
+    {
+    public:
+        SnapshotReader(const std::string& path, size_t entrySize, SnapshotHeader::EKind kind = SnapshotHeader::FULL)
+            : m_Data(0)
+            , m_Bytes(0)
+        {
+            const int file = open(path.c_str(), O_RDONLY);
+            if (file < 0)
+                ThrowSnapshotError(path, "open");
+            struct stat st;
+            if (fstat(file, &st))
+            {
+                close(file);
+                ThrowSnapshotError(path, "stat");
+            }
+            m_Bytes = st.st_size;
+            if (m_Bytes >= sizeof(SnapshotHeader))
+                m_Data = mmap(0, m_Bytes, PROT_READ, MAP_PRIVATE, file, 0);
+            close(file);
+            if (m_Data == MAP_FAILED)
+            {
+                m_Data = 0;
+                ThrowSnapshotError(path, "mmap");
+            }
+            if (!m_Data || !Header().IsValid(entrySize, kind) ||
+                m_Bytes < sizeof(SnapshotHeader) + Header().m_EntryCnt * entrySize)
+            {
+                if (m_Data)
+                    munmap(m_Data, m_Bytes);
+                errno = EINVAL;
+                ThrowSnapshotError(path, "bad format");
+            }
+            // entries are read once from the beginning to the end
+            madvise(m_Data, m_Bytes, MADV_SEQUENTIAL);
+            madvise(m_Data, m_Bytes, MADV_WILLNEED);
+        }
+
+        ~SnapshotReader()
+        {
+            if (m_Data)
+                munmap(m_Data, m_Bytes);
+        }
+
+        const SnapshotHeader& Header() const
+        {
+            return *(const SnapshotHeader*)m_Data;
+        }
+        const void* Entries() const
+        {
+            return (const char*)m_Data + sizeof(SnapshotHeader);
+        }
+
+    private:
+        void* m_Data;
+        size_t m_Bytes;
+    };
+}
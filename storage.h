@@ -0,0 +1,219 @@
+#pragma once
+
+#include "atomic_traits.h"
+#include "allocators.h"
+
+namespace NLFHT
+{
+    template <class K, class V>
+    struct Entry
+    {
+        typedef typename KeyTraits<K>::AtomicKey AtomicKey;
+        typedef typename ValueTraits<V>::AtomicValue AtomicValue;
+
+        AtomicKey m_Key;
+        AtomicValue m_Value;
+
+        Entry()
+            : m_Key(KeyTraits<K>::None())
+            , m_Value(ValueTraits<V>::Baby())
+        {
+        }
+    };
+
+    // Storages define how table entries are laid out in memory.
+    // Each storage is a tag class with nested Array<Key, Value, Policy> template.
+    // Array is the last member of Table and its entries trail the table header
+    // in the same allocation (see Table::AllocSize), so entries address is
+    // known without loading any pointer.
+    // Table addresses its entries by index only:
+    //   Bytes(size)                - size of trailing memory for size entries (static)
+    //   Init(size, clear)          - makes all keys NONE and all values BABY, if clear,
+    //                                trailing memory is zero-filled; without clear
+    //                                entries, which are already there, are kept
+    //   LoadKey(index)             - key of entry
+    //   CasKey(index, new, old)    - compare and set key of entry
+    //   StoreKey(index, key)       - plain store, for table nobody else sees yet
+    //   LoadValue(index)           - value of entry, including COPYING flag
+    //   StoreValue(index, value)
+    //   CasValue(index, new, old)  - compare and set value of entry
+    //   SetCopying(index)          - atomically sets COPYING flag of value
+    //   KeyAddress(index)          - where key is stored, JUST TO DEBUG
+    // Arrays are aligned to cache line.
+    //
+    // With Policy::ZERO_IS_EMPTY keys are stored XOR-ed with NONE and values
+    // XOR-ed with BABY, so zero-filled memory is array of empty entries and
+    // Init has nothing to write. COPYING flag of value must not intersect with
+    // bits of BABY, then SetCopying works on encoded value as is.
+
+    // load/CAS of entries, encoded if ZeroIsEmpty;
+    // Derived provides RawKey(index) and RawValue(index)
+    template <class Derived, class K, class V, bool ZeroIsEmpty>
+    class EntryAccess
+    {
+    public:
+        static const bool ENCODED = ZeroIsEmpty;
+
+        inline K LoadKey(size_t index) const
+        {
+            return Decode<K>(Self().RawKey(index), KeyTraits<K>::None());
+        }
+        inline bool CasKey(size_t index, K newKey, K oldKey)
+        {
+            return KeyTraits<K>::CompareAndSet(Self().RawKey(index),
+                                               Encode<K>(newKey, KeyTraits<K>::None()),
+                                               Encode<K>(oldKey, KeyTraits<K>::None()));
+        }
+
+        inline void StoreKey(size_t index, K key)
+        {
+            Self().RawKey(index) = Encode<K>(key, KeyTraits<K>::None());
+        }
+
+        inline V LoadValue(size_t index) const
+        {
+            return Decode<V>(Self().RawValue(index), ValueTraits<V>::Baby());
+        }
+        inline void StoreValue(size_t index, V value)
+        {
+            Self().RawValue(index) = Encode<V>(value, ValueTraits<V>::Baby());
+        }
+        inline bool CasValue(size_t index, V newValue, V oldValue)
+        {
+            return ValueTraits<V>::CompareAndSet(Self().RawValue(index),
+                                                 Encode<V>(newValue, ValueTraits<V>::Baby()),
+                                                 Encode<V>(oldValue, ValueTraits<V>::Baby()));
+        }
+        inline void SetCopying(size_t index)
+        {
+            ValueTraits<V>::SetCopying(Self().RawValue(index));
+        }
+
+        inline const void* KeyAddress(size_t index) const
+        {
+            return (const void*)&Self().RawKey(index);
+        }
+
+    private:
+        inline const Derived& Self() const
+        {
+            return static_cast<const Derived&>(*this);
+        }
+
+        template <class T>
+        inline static T Encode(T x, T zero)
+        {
+            return ZeroIsEmpty ? (T)((size_t)x ^ (size_t)zero) : x;
+        }
+        template <class T>
+        inline static T Decode(T x, T zero)
+        {
+            return Encode<T>(x, zero);
+        }
+    };
+
+    inline size_t RoundUpToCacheLine(size_t bytes)
+    {
+        return (bytes + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+    }
+
+    // array of {key, value} pairs, value is in the same cache line as key
+    class EntryArrayStorage
+    {
+    public:
+        // layout of entries in table files
+        static const uint32_t LAYOUT = 1;
+
+        template <class K, class V, class Policy>
+        class Array : NonCopyable
+                    , public EntryAccess<Array<K, V, Policy>, K, V, Policy::ZERO_IS_EMPTY>
+        {
+        public:
+            friend class EntryAccess<Array, K, V, Policy::ZERO_IS_EMPTY>;
+
+            typedef Entry<K, V> EntryT;
+            typedef typename EntryT::AtomicKey AtomicKey;
+            typedef typename EntryT::AtomicValue AtomicValue;
+
+            static size_t Bytes(size_t size)
+            {
+                return size * sizeof(EntryT);
+            }
+
+            void Init(size_t size, bool clear)
+            {
+                if (clear && !Policy::ZERO_IS_EMPTY)
+                    for (size_t i = 0; i < size; ++i)
+                        new (m_Entries + i) EntryT();
+            }
+
+            // stored value word, as is
+            inline AtomicValue& RawValue(size_t index) const
+            {
+                return const_cast<EntryT*>(m_Entries)[index].m_Value;
+            }
+
+        private:
+            inline AtomicKey& RawKey(size_t index) const
+            {
+                return const_cast<EntryT*>(m_Entries)[index].m_Key;
+            }
+
+        private:
+            EntryT m_Entries[0] __attribute__((aligned(CACHE_LINE_SIZE)));
+        };
+    };
+
+    // Separate arrays of keys and values.
+    // Probing scans dense array of keys, line of value is touched only
+    // when entry is found or its value is changed.
+    class SplitArrayStorage
+    {
+    public:
+        static const uint32_t LAYOUT = 2;
+
+        template <class K, class V, class Policy>
+        class Array : NonCopyable
+                    , public EntryAccess<Array<K, V, Policy>, K, V, Policy::ZERO_IS_EMPTY>
+        {
+        public:
+            friend class EntryAccess<Array, K, V, Policy::ZERO_IS_EMPTY>;
+
+            typedef typename KeyTraits<K>::AtomicKey AtomicKey;
+            typedef typename ValueTraits<V>::AtomicValue AtomicValue;
+
+            // keys, then values from the next cache line
+            static size_t Bytes(size_t size)
+            {
+                return RoundUpToCacheLine(size * sizeof(AtomicKey)) + size * sizeof(AtomicValue);
+            }
+
+            void Init(size_t size, bool clear)
+            {
+                m_Values = (AtomicValue*)((char*)m_Keys + RoundUpToCacheLine(size * sizeof(AtomicKey)));
+                if (clear && !Policy::ZERO_IS_EMPTY)
+                    for (size_t i = 0; i < size; ++i)
+                    {
+                        m_Keys[i] = KeyTraits<K>::None();
+                        m_Values[i] = ValueTraits<V>::Baby();
+                    }
+            }
+
+            // stored value word, as is
+            inline AtomicValue& RawValue(size_t index) const
+            {
+                return m_Values[index];
+            }
+
+        private:
+            inline AtomicKey& RawKey(size_t index) const
+            {
+                return const_cast<AtomicKey*>(m_Keys)[index];
+            }
+
+        private:
+            AtomicValue* m_Values;
+            AtomicKey m_Keys[0] __attribute__((aligned(CACHE_LINE_SIZE)));
+        };
+    };
+}
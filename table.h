@@ -1,33 +1,96 @@
 #pragma once
 
 #include "atomic_traits.h"
+#include "probing.h"
+#include "storage.h"
+#include "migration.h"
 
 #include <cerrno>
 #include <cmath>
 #include <vector>
+#include <sched.h>
 #include <stdarg.h>
+#include <sys/types.h>
 
 #include "lfht.h"
 
 namespace NLFHT {
-    template <class K, class V>
-    struct Entry
-    {
-        typedef typename KeyTraits<K>::AtomicKey AtomicKey;
-        typedef typename ValueTraits<V>::AtomicValue AtomicValue;
+    template <class Prt, bool IterateAllKeys = false>
+    class TableConstIterator;
+    template <class Prt>
+    class GuardedIterator;
+    template <class Prt>
+    class ConsistentIterator;
+    template <class Prt>
+    class TableOperations;
 
-        AtomicKey m_Key;
-        AtomicValue m_Value;
+    // memory traffic of lookups in entries array, collected by Table::CollectProbeStatistics
+    struct ProbeStatistics
+    {
+        size_t m_KeyCnt;
+        // cache lines touched by lookups of all present keys
+        size_t m_HitCacheLines;
+        size_t m_HomeCnt;
+        // cache lines touched by lookups of absent keys, from every home entry
+        size_t m_MissCacheLines;
+
+        ProbeStatistics()
+            : m_KeyCnt(0)
+            , m_HitCacheLines(0)
+            , m_HomeCnt(0)
+            , m_MissCacheLines(0)
+        {
+        }
 
-        Entry()
-            : m_Key(KeyTraits<K>::None())
-            , m_Value(ValueTraits<V>::Baby())
+        double HitCacheLinesPerLookUp() const
         {
+            return m_KeyCnt ? (double)m_HitCacheLines / m_KeyCnt : 0.;
+        }
+        double MissCacheLinesPerLookUp() const
+        {
+            return m_HomeCnt ? (double)m_MissCacheLines / m_HomeCnt : 0.;
         }
     };
 
-    template <class Prt, bool IterateAllKeys = false>
-    class TableConstIterator;
+    // class incapsulates CAS possibility
+    template <class Value>
+    struct PutCondition
+    {
+        enum EWhenToPut
+        {
+            ALWAYS,
+            IF_ABSENT, // put if THERE IS NO KEY in table. Can put only NONE in this way.
+            IF_EXISTS, // put if THERE IS KEY
+            IF_MATCHES, // put if THERE IS KEY and VALUE MATCHES GIVEN ONE
+
+            COPYING // reserved for TTable internal use
+        };
+
+        EWhenToPut m_When;
+        Value m_Value;
+
+        PutCondition(EWhenToPut when = ALWAYS, Value value = ValueTraits<Value>::None())
+            : m_When(when)
+            , m_Value(value)
+        {
+        }
+
+        // TO DEBUG ONLY
+        std::string ToString() const
+        {
+            std::stringstream tmp;
+            if (m_When == ALWAYS)
+                tmp << "ALWAYS";
+            else if (m_When == IF_EXISTS)
+                tmp << "IF_EXISTS";
+            else if (m_When == IF_ABSENT)
+                tmp << "IF_ABSENT";
+            else
+                tmp << "IF_MATCHES";
+            tmp << " with " << ValueToString<Value>(m_Value);
+            return tmp.str();
+        }
+    };
 
     template <class Prt>
     class Table : NonCopyable
@@ -36,22 +99,34 @@ namespace NLFHT {
         friend class Prt::Self;
         friend class TableConstIterator<Table>;
         friend class TableConstIterator<Table, true>;
+        friend class GuardedIterator<Prt>;
+        friend class ConsistentIterator<Prt>;
+        friend class TableOperations<Prt>;
 
         typedef typename Prt::Self Parent;
         typedef Table Self;
 
         typedef typename Parent::Key Key;
         typedef typename Parent::Value Value;
+        typedef typename Parent::Policy Policy;
 
         typedef typename KeyTraits<Key>::AtomicKey AtomicKey;
         typedef typename ValueTraits<Value>::AtomicValue AtomicValue;
 
-        typedef Entry<Key, Value> EntryT;
         typedef Table<Parent> TableT;
         typedef TableConstIterator<Self> ConstIteratorT;
         typedef TableConstIterator<Self, true> AllKeysConstIterator;
         typedef typename Parent::PutCondition PutCondition;
         typedef typename Parent::SearchHint SearchHint;
+        typedef typename Policy::Probing::template Engine<Self> ProbingEngine;
+
+        friend ProbingEngine;
+
+        // returned by LookUp if table has no entry with key and no empty entries
+        static const size_t NO_ENTRY = (size_t)-1;
+        // entries per dirty bit, see Policy::DIRTY_REGION_BYTES
+        static const size_t DIRTY_REGION_SIZE = Policy::DIRTY_REGION_BYTES / (sizeof(Key) + sizeof(Value)) ?
+                                                Policy::DIRTY_REGION_BYTES / (sizeof(Key) + sizeof(Value)) : 1;
 
         enum EResult {
             FULL_TABLE,
@@ -63,19 +138,36 @@ namespace NLFHT {
         };
 
     public:
-        Table(Parent* parent, size_t size)
-            : m_Size( FastClp2(size) )
-            , m_SizeMinusOne(m_Size - 1)
-            , m_MinProbeCnt(m_Size)
-            , m_IsFullFlag(false)
-            , m_CopiedCnt(0)
-            , m_CopyTaskSize(0)
+        // table must be placed in zero-filled memory of AllocSize(size) bytes;
+        // attached one is placed over block of table file (see LFHashTable::Open)
+        // and keeps entries and bitmaps, which are already there
+        Table(Parent* parent, size_t size, bool attached = false)
+            : m_Size( RoundSize(size) )
+            , m_BucketCnt(m_Size / Policy::BUCKET_SIZE)
+            , m_HomeMask((m_Size - 1) & ~(Policy::BUCKET_SIZE - 1))
             , m_Parent(parent)
             , m_Next(0)
+            , m_IsFullFlag(false)
+            , m_CopyTaskSize(0)
+            , m_MinProbeCnt(m_Size)
+            , m_CopiedCnt(0)
             , m_NextToDelete(0)
+            , m_NextHigh(0)
+            , m_SplitShift(0)
+            , m_Depth(0)
+            , m_Prefix(0)
+            , m_KeyCnt(0)
+            , m_AllocSize(0)
+            , m_Occupancy(Policy::OCCUPANCY_BITMAP ? (Atomic*)((char*)this + OccupancyOffset(m_Size)) : 0)
+            , m_FrozenValues(0)
+            , m_FrozenBy(0)
+            , m_FrozenByProcess(0)
+            , m_Dirty(Policy::DIRTY_REGION_BYTES ? (Atomic*)((char*)this + DirtyOffset(m_Size)) : 0)
+            , m_Probing(this)
         {
             VERIFY(m_Size, "Size must be non-zero\n");
-            m_Data.resize(m_Size);
+            m_Data.Init(m_Size, !attached);
+            m_Probing.Init(m_Size, (char*)this + ProbingOffset(m_Size));
             const double tooBigDensity = Min(0.7, 2 * m_Parent->m_Density);
             m_UpperKeyCountBound = Min(m_Size, (size_t)(ceil(tooBigDensity * m_Size)));
 
@@ -88,11 +180,24 @@ namespace NLFHT {
 #ifdef TRACE
             Trace(Cerr, "TTable destructor called\n");
 #endif
+            if (m_FrozenValues)
+                Policy::Memory::Deallocate(m_FrozenValues, FrozenBytes(m_Size));
 #ifndef NDEBUG
             AtomicIncrement(m_Parent->m_TablesDeleted);
 #endif
         }
 
+        // bytes of table header and its trailing entries
+        static size_t AllocSize(size_t size)
+        {
+            const size_t roundSize = RoundSize(size);
+            if (Policy::DIRTY_REGION_BYTES)
+                return DirtyOffset(roundSize) + DirtyWordCnt(roundSize) * sizeof(Atomic);
+            if (Policy::OCCUPANCY_BITMAP)
+                return OccupancyOffset(roundSize) + (roundSize + 63) / 64 * sizeof(Atomic);
+            return ProbingOffset(roundSize) + ProbingEngine::Bytes(roundSize);
+        }
+
         inline bool IsFull() const
         {
             return m_IsFullFlag;
@@ -103,20 +208,32 @@ namespace NLFHT {
         {
             return m_Next;
         }
+        // next table for key with given hash: table can be split in two next ones
+        inline TableT* GetNext(size_t hashValue) const
+        {
+            TableT* next = m_Next;
+            if (EXPECT_FALSE(m_NextHigh != 0) && ((hashValue >> m_SplitShift) & 1))
+                return m_NextHigh;
+            return next;
+        }
         inline TableT* GetNextToDelete() const
         {
             return m_NextToDelete;
         }
 
 // table access methods
-        inline bool GetEntry(EntryT* entry, Value& value);
+        inline void Prefetch(size_t hashValue) const
+        {
+            m_Probing.Prefetch(hashValue);
+        }
+        inline bool GetEntry(size_t index, Value& value);
         bool Get(Key key, size_t hashValue, Value& value, SearchHint* hint);
 
-        EResult FetchEntry(Key key, EntryT* entry,
+        EResult FetchEntry(Key key, size_t hashValue, size_t index,
                            bool thereWasKey, bool& keyIsInstalled, const PutCondition& cond);
-        EResult PutEntry(EntryT* entry, Value value,
+        EResult PutEntry(size_t index, Value value,
                          const PutCondition& cond, bool updateAliveCnt);
-        EResult Put(Key key, Value value,
+        EResult Put(Key key, size_t hashValue, Value value,
                     const PutCondition& cond, bool& keyInstalled, bool updateAliveCnt = true);
 
         ConstIteratorT Begin() const {
@@ -128,36 +245,215 @@ namespace NLFHT {
 
         // JUST TO DEBUG
         void Print(std::ostream& ostr, bool compact = false);
-
-        size_t m_AllocSize;
+        // NOT thread-safe
+        void CollectProbeStatistics(ProbeStatistics& stats) const;
 
     private:
+        typedef typename Policy::Storage::template Array<Key, Value, Policy> TData;
+
+        // first cache line, read by every operation
         const size_t m_Size;
-        const size_t m_SizeMinusOne;
-        Atomic m_MinProbeCnt;
+        const size_t m_BucketCnt;
+        // home entries are always first entries of buckets
+        const size_t m_HomeMask;
+        Parent* m_Parent;
+        TableT *volatile m_Next;
         volatile bool m_IsFullFlag;
         size_t m_UpperKeyCountBound;
-
-        Atomic m_CopiedCnt;
         size_t m_CopyTaskSize;
 
-        typedef std::vector<EntryT> TData;
-        TData m_Data;
+        // contended counters, each on its own cache line
+        Atomic m_MinProbeCnt __attribute__((aligned(CACHE_LINE_SIZE)));
+        Atomic m_CopiedCnt __attribute__((aligned(CACHE_LINE_SIZE)));
+
+        TableT *volatile m_NextToDelete __attribute__((aligned(CACHE_LINE_SIZE)));
+        // table split by parent (see SegmentedHashTable): keys with bit
+        // m_SplitShift of hash set go to m_NextHigh instead of m_Next
+        TableT *volatile m_NextHigh;
+        size_t m_SplitShift;
+        // table is segment of directory: keys with m_Depth directory bits equal to m_Prefix
+        size_t m_Depth;
+        size_t m_Prefix;
+        // keys installed into table, counted only by parents, which need it
+        Atomic m_KeyCnt __attribute__((aligned(CACHE_LINE_SIZE)));
+        size_t m_AllocSize;
+        // with Policy::OCCUPANCY_BITMAP bits of entries, which may be alive,
+        // trail entries and probing metadata, zero-filled as they are
+        Atomic* m_Occupancy;
+        // values of frozen table as they were at freezing, saved by the first
+        // change of entry since then; claimed and saved bits of entries trail them;
+        // set by parent, see LFHashTable::FreezeHead
+        Value* volatile m_FrozenValues;
+        // thread, which froze table, while m_FrozenValues are set
+        volatile size_t m_FrozenBy;
+        volatile pid_t m_FrozenByProcess;
+        // with Policy::DIRTY_REGION_BYTES bits of regions of entries, changed since
+        // last checkpoint, trail occupancy bits or probing metadata
+        Atomic* m_Dirty;
+        SpinLock m_Lock;
 
-        Parent* m_Parent;
-        TableT *volatile m_Next;
-        TableT *volatile m_NextToDelete;
+        ProbingEngine m_Probing;
 
-        SpinLock m_Lock;
+        // must be the last member: entries trail the table,
+        // aligned to cache line, so bucket never straddles two lines
+        TData m_Data;
 
     private:
         template<bool CheckFull>
-        EntryT* LookUp(Key key, size_t hash, Key& foundKey);
-        void Copy(EntryT* entry);
+        size_t LookUp(Key key, size_t hash, Key& foundKey);
+        void Copy(size_t index);
+
+        // NOT thread-safe, fills table nobody else sees yet, counters are not changed;
+        // table must have room, false if key was there and its value is replaced
+        bool PutNew(Key key, Value value);
+
+        // for GuardedIterator, which walks tables from first one:
+        // false if entry has no alive key or key is installed in table before this one
+        bool GetAliveEntry(size_t index, TableT* first, Key& key, Value& value);
+        // for ConsistentIterator: false if entry had no alive key, when table was frozen
+        bool GetFrozenEntry(size_t index, Key& key, Value& value);
+        // for WriteDelta: false if entry has no key, value of not alive key is NoneValue
+        bool GetDeltaEntry(size_t index, Key& key, Value& value);
+        // copying of entry from dirty region makes region of key dirty in this table
+        void MarkDirtyKey(Key key, size_t hashValue);
+        // value of key from entry, taking copying to next tables into account,
+        // NoneValue if key is not alive; doesn't help to copy
+        Value CurrentValue(size_t index, Key key, size_t hashValue);
+
+        // table size is power of two number of buckets,
+        // with Policy::EXACT_SIZE it's just enough buckets
+        static size_t RoundSize(size_t size)
+        {
+            const size_t bucketCnt = (size + Policy::BUCKET_SIZE - 1) / Policy::BUCKET_SIZE;
+            return (Policy::EXACT_SIZE ? bucketCnt : FastClp2(bucketCnt)) * Policy::BUCKET_SIZE;
+        }
+        // metadata of probing engine trails entries, bitmaps trail it
+        static size_t ProbingOffset(size_t roundSize)
+        {
+            return RoundUpToCacheLine(sizeof(Table) + TData::Bytes(roundSize));
+        }
+        static size_t OccupancyOffset(size_t roundSize)
+        {
+            return RoundUpToCacheLine(ProbingOffset(roundSize) + ProbingEngine::Bytes(roundSize));
+        }
+        static size_t DirtyOffset(size_t roundSize)
+        {
+            if (Policy::OCCUPANCY_BITMAP)
+                return RoundUpToCacheLine(OccupancyOffset(roundSize) + (roundSize + 63) / 64 * sizeof(Atomic));
+            return OccupancyOffset(roundSize);
+        }
+        // values of frozen table, then claimed bits, then saved bits
+        static size_t FrozenValueBytes(size_t roundSize)
+        {
+            return (roundSize * sizeof(Value) + sizeof(Atomic) - 1) / sizeof(Atomic) * sizeof(Atomic);
+        }
+        static size_t FrozenBytes(size_t roundSize)
+        {
+            return FrozenValueBytes(roundSize) + 2 * (roundSize + 63) / 64 * sizeof(Atomic);
+        }
+        inline Atomic* FrozenClaimed(Value* frozenValues) const
+        {
+            return (Atomic*)((char*)frozenValues + FrozenValueBytes(m_Size));
+        }
+        inline Atomic* FrozenSaved(Value* frozenValues) const
+        {
+            return FrozenClaimed(frozenValues) + (m_Size + 63) / 64;
+        }
+        // entry of frozen table is going to be changed: the first thread, which
+        // claims entry, saves its value, others wait for it, then change it;
+        // frozenValues are read once, parent may unfreeze table meanwhile
+        void SaveFrozenValue(Value* frozenValues, size_t index);
+        static size_t DirtyWordCnt(size_t roundSize)
+        {
+            return ((roundSize + DIRTY_REGION_SIZE - 1) / DIRTY_REGION_SIZE + 63) / 64;
+        }
+        // entry is going to be changed: set before CAS, so copying,
+        // which checks bit after entry is locked, carries it to next table
+        inline void MarkDirty(size_t index)
+        {
+            const size_t region = index / DIRTY_REGION_SIZE;
+            const AtomicBase bit = (AtomicBase)((uint64_t)1 << (region % 64));
+            if (!(m_Dirty[region / 64] & bit))
+                AtomicOr(m_Dirty[region / 64], bit);
+        }
+        inline bool IsDirty(size_t index) const
+        {
+            const size_t region = index / DIRTY_REGION_SIZE;
+            return (uint64_t)m_Dirty[region / 64] & ((uint64_t)1 << (region % 64));
+        }
+        // for WriteDelta: clears bits of word and returns them
+        AtomicBase TakeDirtyWord(size_t word)
+        {
+            const AtomicBase bits = m_Dirty[word];
+            if (bits)
+                AtomicAnd(m_Dirty[word], ~bits);
+            return bits;
+        }
+        // entries [begin, end) of dirty region
+        void DirtyRegion(size_t region, size_t& begin, size_t& end) const
+        {
+            begin = region * DIRTY_REGION_SIZE;
+            end = Min(m_Size, begin + DIRTY_REGION_SIZE);
+        }
+        // entry may be alive: set after value became alive
+        inline void MarkOccupied(size_t index)
+        {
+            AtomicOr(m_Occupancy[index / 64], (AtomicBase)((uint64_t)1 << (index % 64)));
+        }
+        // entry is not alive: cleared after value stopped to be alive,
+        // but other thread could make it alive again and set bit before us
+        inline void MarkFree(size_t index)
+        {
+            AtomicAnd(m_Occupancy[index / 64], (AtomicBase)~((uint64_t)1 << (index % 64)));
+            const Value value = PureValue(m_Data.LoadValue(index));
+            if (!ValueIsNone(value) && !ValueIsBaby(value))
+                MarkOccupied(index);
+        }
+        // first entry from index on, which may be alive, m_Size if there is none;
+        // complete only while table is not copied (copying doesn't touch bits)
+        inline size_t NextOccupied(size_t index) const
+        {
+            if (!Policy::OCCUPANCY_BITMAP || index >= m_Size)
+                return index;
+            size_t word = index / 64;
+            uint64_t bits = (uint64_t)m_Occupancy[word] & (~(uint64_t)0 << (index % 64));
+            const size_t wordCnt = (m_Size + 63) / 64;
+            while (!bits)
+            {
+                if (++word == wordCnt)
+                    return m_Size;
+                bits = m_Occupancy[word];
+            }
+            return Min(m_Size, word * 64 + __builtin_ctzll(bits));
+        }
+        // first entry from index on, which guarded pass must visit: keys of
+        // tables being copied are visited even if their values are moved
+        inline size_t NextToVisit(size_t index) const
+        {
+            return m_Next ? index : NextOccupied(index);
+        }
+
+        inline size_t HomeIndex(size_t hash) const
+        {
+            if (Policy::EXACT_SIZE)
+                // multiply-shift range reduction, takes high bits of hash
+                return (size_t)(((unsigned __int128)hash * m_BucketCnt) >> 64) * Policy::BUCKET_SIZE;
+            return hash & m_HomeMask;
+        }
 
+        // next table(s) are created by parent, SetNext publishes them
         void CreateNext();
+        // parent decided to move keys to next table(s) before table is full
+        void StartCopying()
+        {
+            m_IsFullFlag = true;
+            CreateNext();
+        }
+        void SetNext(TableT* next, TableT* nextHigh = 0, size_t splitShift = 0);
         void PrepareToDelete();
-        void DoCopyTask();
+        // byOperation is false for migration workers and bulk copying,
+        // their tasks are not limited by copy budget
+        void DoCopyTask(bool byOperation = true);
 
         // traits wrappers
         inline static Key NoneKey() {
@@ -194,6 +490,10 @@ namespace NLFHT {
         {
             return KeysAreEqual(key, NoneKey());
         }
+        FORCED_INLINE size_t Hash(Key key) const
+        {
+            return m_Parent->m_Hash(key);
+        }
         FORCED_INLINE bool KeysAreEqual(Key lft, Key rgh) const
         {
             return m_Parent->m_KeysAreEqual(lft, rgh);
@@ -206,27 +506,24 @@ namespace NLFHT {
         inline static bool IsCopying(Value value) {
             return ValueTraits<Value>::IsCopying(value);
         }
-        inline static void SetCopying(AtomicValue& value) {
-            ValueTraits<Value>::SetCopying(value);
-        }
         inline static Value PureValue(Value value) {
             return ValueTraits<Value>::PureValue(value);
         }
 
-        inline bool KeysCompareAndSet(AtomicKey& key, Key newKey, Key oldKey) {
-            return KeyTraits<Key>::CompareAndSet(key, newKey, oldKey);
-        }
-        inline bool ValuesCompareAndSet(AtomicValue& value, Value newValue, Value oldValue) {
-            return ValueTraits<Value>::CompareAndSet(value, newValue, oldValue);
-        }
 
         inline void UnRefKey(Key key, size_t cnt = 1)
         {
             m_Parent->m_KeyManager.UnRef(key, cnt);
         }
-        inline void ReadValueAndRef(Value& value, const AtomicValue& atomicValue)
+        inline void ReadValueAndRef(Value& value, size_t index)
         {
-            m_Parent->m_ValueManager.ReadAndRef(value, atomicValue);
+            if (TData::ENCODED) {
+                // manager reads decoded copy
+                const AtomicValue decoded(m_Data.LoadValue(index));
+                m_Parent->m_ValueManager.ReadAndRef(value, decoded);
+            } else {
+                m_Parent->m_ValueManager.ReadAndRef(value, m_Data.RawValue(index));
+            }
         }
         inline void UnRefValue(Value value, size_t cnt = 1) {
             m_Parent->m_ValueManager.UnRef(value, cnt);
@@ -255,11 +552,7 @@ namespace NLFHT {
         }
         void IncreaseKeyCnt()
         {
-            m_Parent->m_Guard->IncreaseKeyCnt();
-        }
-        void ZeroKeyCnt()
-        {
-            m_Parent->m_GuardManager.ZeroKeyCnt();
+            m_Parent->IncreaseKeyCnt(this);
         }
 
         // JUST TO DEBUG
@@ -297,16 +590,14 @@ namespace NLFHT {
         typedef typename Parent::AtomicKey AtomicKey;
         typedef typename Parent::AtomicValue AtomicValue;
 
-        typedef Entry<TKey, TValue> TEntryT;
-
         inline TKey Key() const
         {
-            return m_Parent->m_Data[m_Index].m_Key;
+            return m_Parent->m_Data.LoadKey(m_Index);
         }
 
         inline TValue Value() const
         {
-            return m_Parent->m_Data[m_Index].m_Value;
+            return m_Parent->m_Data.LoadValue(m_Index);
         }
 
         inline const Parent* GetParent() const
@@ -353,13 +644,22 @@ namespace NLFHT {
         {
             ++m_Index;
             for (; m_Index < m_Parent->m_Size; ++m_Index)
-                if (IsValidEntry(m_Parent->m_Data[m_Index]))
+            {
+                // all keys are wanted with their tombstones
+                if (!IterateAllKeys)
+                {
+                    m_Index = m_Parent->NextOccupied(m_Index);
+                    if (m_Index >= m_Parent->m_Size)
+                        break;
+                }
+                if (IsValidEntry(m_Index))
                     break;
+            }
         }
-        bool IsValidEntry(const TEntryT& entry)
+        bool IsValidEntry(size_t index)
         {
-            const AtomicKey& key = entry.m_Key;
-            TValue value = ValueTraits<TValue>::PureValue(entry.m_Value);
+            const TKey key = m_Parent->m_Data.LoadKey(index);
+            TValue value = ValueTraits<TValue>::PureValue(m_Parent->m_Data.LoadValue(index));
             if (KeyTraits<TKey>::IsReserved(key))
                 return false;
             if (IterateAllKeys)
@@ -378,41 +678,12 @@ namespace NLFHT {
 
     template <class Prt>
     template <bool CheckFull>
-    typename Table<Prt>::EntryT*
-    Table<Prt>::LookUp(Key key, size_t hash, Key& foundKey) {
+    size_t Table<Prt>::LookUp(Key key, size_t hash, Key& foundKey) {
         assert(!KeyIsNone(key));
         OnLookUp();
 
-        typename TData::iterator i = m_Data.begin() + (hash & m_SizeMinusOne);
-        AtomicBase probeCnt = m_Size;
-
-        EntryT* returnEntry;
-        do {
-            EntryT& entry = *i;
-            const Key entryKey(entry.m_Key);
-
-            if (KeysAreEqual(entryKey, key)) {
-                foundKey = key;
-                returnEntry = &entry;
-                break;
-            }
-            if (KeyIsNone(entryKey)) {
-                foundKey = NoneKey();
-                returnEntry = &entry;
-                break;
-            }
-
-            ++i;
-            if (EXPECT_FALSE(i == m_Data.end()))
-                i = m_Data.begin();
-            --probeCnt;
-        } while (probeCnt);
-
-        if (EXPECT_FALSE(0 == probeCnt))
-        {
-            foundKey = NoneKey();
-            returnEntry = 0;
-        }
+        AtomicBase probeCnt;
+        size_t returnIndex = m_Probing.Find(key, hash, foundKey, probeCnt);
 
         if (CheckFull)
         {
@@ -421,7 +692,7 @@ namespace NLFHT {
             {
                 if (AtomicCas(&m_MinProbeCnt, probeCnt, oldCnt))
                 {
-                    const size_t keysCnt = m_Parent->m_GuardManager.TotalKeyCnt();
+                    const size_t keysCnt = m_Parent->KeyCnt(this);
 
                     // keysCnt is approximate, that's why we must check that table is absolutely full
                     if (keysCnt >= m_UpperKeyCountBound)
@@ -432,25 +703,25 @@ namespace NLFHT {
             }
             // cause TotalKeyCnt is approximate, sometimes table be absotely full, even
             // when previous check fails
-            if (!returnEntry && !m_IsFullFlag)
+            if (returnIndex == NO_ENTRY && !m_IsFullFlag)
                 m_IsFullFlag = true;
         }
 
-        return returnEntry;
+        return returnIndex;
     }
 
     // try to take value from entry
     // return false, if entry was copied
     template <class Prt>
-    inline bool Table<Prt>::GetEntry(EntryT* entry, Value& value) {
+    inline bool Table<Prt>::GetEntry(size_t index, Value& value) {
 #ifdef TRACE
-        Trace(Cerr, "GetEntry in %zd\n", entry - &Data[0]);
+        Trace(Cerr, "GetEntry in %zd\n", index);
 #endif
-        if (EXPECT_FALSE(IsCopying(Value(entry->m_Value))))
+        if (EXPECT_FALSE(IsCopying(m_Data.LoadValue(index))))
         {
-            Copy(entry);
+            Copy(index);
         }
-        ReadValueAndRef(value, entry->m_Value);
+        ReadValueAndRef(value, index);
         const bool canBeInNextTables = ValueIsCopied(value) || ValueIsDeleted(value);
         return !canBeInNextTables;
     }
@@ -460,7 +731,7 @@ namespace NLFHT {
     template <class Prt>
     inline bool Table<Prt>::Get(Key key, size_t hashValue, Value& value, SearchHint*) {
         Key foundKey;
-        EntryT* entry = LookUp<false>(key, hashValue, foundKey);
+        const size_t index = LookUp<false>(key, hashValue, foundKey);
 
         // remember current head number before checking copy state
         // AtomicBase tableNumber = Parent->TableNumber;
@@ -468,7 +739,7 @@ namespace NLFHT {
         bool result;
         const bool keySet = !KeyIsNone(foundKey);
         if (keySet) {
-            result = GetEntry(entry, value);
+            result = GetEntry(index, value);
         } else {
             // if table is full we should continue search
             value = NoneValue();
@@ -489,71 +760,216 @@ namespace NLFHT {
             return;
         }
 
-        const size_t aliveCnt = Max((AtomicBase)1, m_Parent->m_GuardManager.TotalAliveCnt());
-        const size_t nextSize = Max((size_t)1, (size_t)ceil(aliveCnt * (1. / m_Parent->m_Density)));
-        ZeroKeyCnt();
-
-        m_Next = m_Parent->CreateTable(m_Parent, nextSize);
+        try
+        {
+            m_Parent->CreateNextTables(this);
+        }
+        catch (...)
+        {
+            // table stays full without next ones, next Put tries again
+            m_Lock.Release();
+            throw;
+        }
 #ifdef TRACE
         Trace(Cerr, "Table done\n");
 #endif
-        m_CopyTaskSize = Max((size_t)logf(m_Size) + 1, 2 * (m_Size / (size_t)(m_Parent->m_Density * m_Next->m_Size + 1)));
 
         m_Lock.Release();
+        // may block, so it's out of spin lock
+        m_Parent->OnNextTableCreated();
+    }
+
+    template <class Prt>
+    void Table<Prt>::SetNext(TableT* next, TableT* nextHigh, size_t splitShift) {
+        m_CopyTaskSize = Max((size_t)logf(m_Size) + 1, 2 * (m_Size / (size_t)(m_Parent->m_Density * next->m_Size + 1)));
+        m_NextHigh = nextHigh;
+        m_SplitShift = splitShift;
+        // the last one: non-zero m_Next means that other fields are set
+        m_Next = next;
     }
 
     template <class Prt>
-    void Table<Prt>::Copy(Entry<Key, Value>* entry) {
+    void Table<Prt>::Copy(size_t index) {
         OnCopy();
 
-        SetCopying(entry->m_Value);
+        m_Data.SetCopying(index);
         // by now entry is locked for modifications (except becoming TOMBSTONE)
         // cause nobody does CAS on copying values
 
         // remember the value to copy to the next table
-        Value entryValue(PureValue(entry->m_Value));
+        Value entryValue(PureValue(m_Data.LoadValue(index)));
 
         if (ValueIsDeleted(entryValue) || ValueIsCopied(entryValue))
         {
             return;
         }
+        Value* frozenValues = m_FrozenValues;
+        if (EXPECT_FALSE(frozenValues != 0))
+            SaveFrozenValue(frozenValues, index);
         if (ValueIsBaby(entryValue))
         {
-            entry->m_Value = CopiedValue();
+            m_Data.StoreValue(index, CopiedValue());
             return;
         }
-        if (ValueIsNone(entryValue))
+        // deleted key of dirty region is copied too, so next delta has it
+        const bool isDirty = Policy::DIRTY_REGION_BYTES && IsDirty(index);
+        if (ValueIsNone(entryValue) && !isDirty)
         {
-            entry->m_Value = DeletedValue();
+            m_Data.StoreValue(index, DeletedValue());
             return;
         }
 
         TableT* current = this;
-        Key entryKey = entry->m_Key;
-        while (!ValueIsCopied(PureValue(entry->m_Value)))
+        Key entryKey = m_Data.LoadKey(index);
+        const size_t hashValue = m_Probing.HashOf(index, entryKey);
+        while (!ValueIsCopied(PureValue(m_Data.LoadValue(index))))
         {
             if (!current->m_Next)
                 current->CreateNext();
-            TableT* target = current->m_Next;
+            TableT* target = current->GetNext(hashValue);
 
             bool tmp;
-            if (target->Put(entryKey, entryValue, PutCondition(PutCondition::COPYING, BabyValue()), tmp, false) != FULL_TABLE)
-                entry->m_Value = CopiedValue();
+            if (target->Put(entryKey, hashValue, entryValue, PutCondition(PutCondition::COPYING, BabyValue()), tmp, false) != FULL_TABLE)
+            {
+                if (isDirty)
+                    target->MarkDirtyKey(entryKey, hashValue);
+                m_Data.StoreValue(index, CopiedValue());
+            }
             else
                 current = target;
         }
     }
 
+    template <class Prt>
+    bool Table<Prt>::PutNew(Key key, Value value) {
+        const size_t hashValue = Hash(key);
+        Key foundKey;
+        const size_t index = LookUp<false>(key, hashValue, foundKey);
+        VERIFY(index != NO_ENTRY, "No room in new table\n");
+        const bool isNew = KeyIsNone(foundKey);
+        if (isNew)
+        {
+            m_Data.StoreKey(index, key);
+            m_Probing.OnKeyInstalled(index, hashValue);
+        }
+        m_Data.StoreValue(index, value);
+        if (Policy::OCCUPANCY_BITMAP)
+            MarkOccupied(index);
+        return isNew;
+    }
+
+    template <class Prt>
+    bool Table<Prt>::GetAliveEntry(size_t index, TableT* first, Key& key, Value& value) {
+        key = m_Data.LoadKey(index);
+        if (KeyTraits<Key>::IsReserved(key))
+            return false;
+        const size_t hashValue = m_Probing.HashOf(index, key);
+        // keys are never removed from tables, so key of previous table
+        // was visited there
+        for (TableT* prev = first; prev != this; prev = prev->GetNext())
+        {
+            Key foundKey;
+            const size_t prevIndex = prev->template LookUp<false>(key, hashValue, foundKey);
+            if (prevIndex != NO_ENTRY && !KeyIsNone(foundKey))
+                return false;
+        }
+        value = CurrentValue(index, key, hashValue);
+        return !ValueIsNone(value);
+    }
+
+    template <class Prt>
+    bool Table<Prt>::GetFrozenEntry(size_t index, Key& key, Value& value) {
+        key = m_Data.LoadKey(index);
+        if (KeyTraits<Key>::IsReserved(key))
+            return false;
+        // value is changed after saved bit is set, so value, read before the bit
+        // is seen, is the one table had at freezing
+        value = PureValue(m_Data.LoadValue(index));
+        CompilerBarrier();
+        if ((uint64_t)FrozenSaved(m_FrozenValues)[index / 64] & ((uint64_t)1 << (index % 64)))
+            value = m_FrozenValues[index];
+        return !ValueIsNone(value) && !ValueIsBaby(value);
+    }
+
+    template <class Prt>
+    void Table<Prt>::SaveFrozenValue(Value* frozenValues, size_t index) {
+        Atomic& saved = FrozenSaved(frozenValues)[index / 64];
+        const AtomicBase bit = (AtomicBase)((uint64_t)1 << (index % 64));
+        if (saved & bit)
+            return;
+        Atomic& claimed = FrozenClaimed(frozenValues)[index / 64];
+        AtomicBase bits;
+        while (!((bits = claimed) & bit))
+        {
+            if (AtomicCas(&claimed, bits | bit, bits))
+            {
+                frozenValues[index] = PureValue(m_Data.LoadValue(index));
+                AtomicOr(saved, bit);
+                return;
+            }
+        }
+        // owner of claim saves value in a few instructions
+        while (!(saved & bit))
+            CompilerBarrier();
+    }
+
+    template <class Prt>
+    bool Table<Prt>::GetDeltaEntry(size_t index, Key& key, Value& value) {
+        key = m_Data.LoadKey(index);
+        if (KeyTraits<Key>::IsReserved(key))
+            return false;
+        value = CurrentValue(index, key, m_Probing.HashOf(index, key));
+        return true;
+    }
+
+    template <class Prt>
+    void Table<Prt>::MarkDirtyKey(Key key, size_t hashValue) {
+        Key foundKey;
+        const size_t index = LookUp<false>(key, hashValue, foundKey);
+        if (index != NO_ENTRY && !KeyIsNone(foundKey))
+            MarkDirty(index);
+    }
+
+    template <class Prt>
+    typename Table<Prt>::Value
+    Table<Prt>::CurrentValue(size_t index, Key key, size_t hashValue) {
+        // value of entry, which is being copied, is current one
+        // until it or newer value appears in next table
+        Value candidate = NoneValue();
+        TableT* table = this;
+        while (true)
+        {
+            const Value rawValue = table->m_Data.LoadValue(index);
+            const Value value = PureValue(rawValue);
+            if (ValueIsBaby(value))
+                return candidate;
+            if (!ValueIsCopied(value) && !ValueIsDeleted(value))
+            {
+                if (!IsCopying(rawValue))
+                    return value;
+                candidate = value;
+            }
+
+            table = table->GetNext(hashValue);
+            if (!table)
+                return candidate;
+            Key foundKey;
+            index = table->template LookUp<false>(key, hashValue, foundKey);
+            if (index == NO_ENTRY || KeyIsNone(foundKey))
+                return candidate;
+        }
+    }
+
     template <class Prt>
     typename Table<Prt>::EResult
-    Table<Prt>::PutEntry(EntryT* entry, Value value, const PutCondition& cond, bool updateCnt) {
+    Table<Prt>::PutEntry(size_t index, Value value, const PutCondition& cond, bool updateCnt) {
 #ifdef TRACE
-        Trace(Cerr, "PutEntry in entry %zd value %s under condition %s\n", entry - &Data[0],
+        Trace(Cerr, "PutEntry in entry %zd value %s under condition %s\n", index,
                      ~ValueToString<TValue>(value), ~cond.ToString());
 #endif
 
-        if (EXPECT_FALSE(IsCopying(entry->m_Value))) {
-            Copy(entry);
+        if (EXPECT_FALSE(IsCopying(m_Data.LoadValue(index)))) {
+            Copy(index);
             return FULL_TABLE;
         }
 
@@ -565,9 +981,9 @@ namespace NLFHT {
         if (shouldRefWhenRead) {
             // we want to compare with oldValue
             // we need guaranty, that it's not deleted
-            ReadValueAndRef(oldValue, entry->m_Value);
+            ReadValueAndRef(oldValue, index);
         } else {
-            oldValue = PureValue(entry->m_Value);
+            oldValue = PureValue(m_Data.LoadValue(index));
         }
         if (ValueIsDeleted(oldValue) || ValueIsCopied(oldValue))
         {
@@ -601,14 +1017,30 @@ namespace NLFHT {
                 assert(0);
         }
 
-        if (ValuesCompareAndSet(entry->m_Value, value, oldValue)) {
-            if (updateCnt) {
+        if (Policy::DIRTY_REGION_BYTES && cond.m_When != PutCondition::COPYING)
+            MarkDirty(index);
+        Value* frozenValues = m_FrozenValues;
+        if (EXPECT_FALSE(frozenValues != 0))
+            SaveFrozenValue(frozenValues, index);
+
+        if (m_Data.CasValue(index, value, oldValue)) {
+            if (updateCnt || Policy::OCCUPANCY_BITMAP) {
                 bool oldIsAlive = !ValueIsNone(oldValue) && !ValueIsBaby(oldValue);
                 bool newIsAlive = !ValueIsNone(value) && !ValueIsBaby(value);
                 if (!newIsAlive && oldIsAlive)
-                    DecreaseAliveCnt();
+                {
+                    if (updateCnt)
+                        DecreaseAliveCnt();
+                    if (Policy::OCCUPANCY_BITMAP)
+                        MarkFree(index);
+                }
                 if (newIsAlive && !oldIsAlive)
-                    IncreaseAliveCnt();
+                {
+                    if (updateCnt)
+                        IncreaseAliveCnt();
+                    if (Policy::OCCUPANCY_BITMAP)
+                        MarkOccupied(index);
+                }
             }
             UnRefValue(oldValue, successRefCnt);
             // we do not Ref value, so *value can't be used now
@@ -622,13 +1054,13 @@ namespace NLFHT {
 
     template <class Prt>
     typename Table<Prt>::EResult
-    Table<Prt>::FetchEntry(Key key, EntryT* entry, bool thereWasKey, bool& keyInstalled, const PutCondition& cond) {
+    Table<Prt>::FetchEntry(Key key, size_t hashValue, size_t index, bool thereWasKey, bool& keyInstalled, const PutCondition& cond) {
         keyInstalled = false;
 
-        if (!entry)
+        if (index == NO_ENTRY)
             return FULL_TABLE;
         if (IsFull()) {
-            Copy(entry);
+            Copy(index);
             return FULL_TABLE;
         }
 
@@ -637,16 +1069,17 @@ namespace NLFHT {
             return CONTINUE;
 
         // if key is NONE, try to get entry
-        Key entryKey = entry->m_Key;
+        Key entryKey = m_Data.LoadKey(index);
         if (KeyIsNone(entryKey)) {
             if (cond.m_When == PutCondition::IF_EXISTS ||
                 cond.m_When == PutCondition::IF_MATCHES)
                 return FAILED;
-            if (!KeysCompareAndSet(entry->m_Key, key, NoneKey())) {
+            if (!m_Data.CasKey(index, key, NoneKey())) {
                 return RETRY;
             }
 
             keyInstalled = true;
+            m_Probing.OnKeyInstalled(index, hashValue);
             IncreaseKeyCnt();
             return CONTINUE;
         }
@@ -660,22 +1093,21 @@ namespace NLFHT {
 
     template <class Prt>
     typename Table<Prt>::EResult
-    Table<Prt>::Put(Key key, Value value, const PutCondition& cond, bool& keyInstalled, bool updateAliveCnt)
+    Table<Prt>::Put(Key key, size_t hashValue, Value value, const PutCondition& cond, bool& keyInstalled, bool updateAliveCnt)
     {
         OnPut();
 
-        const size_t hashValue = m_Parent->m_Hash(key);
         EResult result = RETRY;
 
-        EntryT* entry = 0;
+        size_t index = NO_ENTRY;
 #ifndef NDEBUG
         for (size_t cnt = 0; RETRY == result; ++cnt) {
 #else
         while (RETRY == result) {
 #endif
             Key foundKey;
-            entry = LookUp<true>(key, hashValue, foundKey);
-            result = FetchEntry(key, entry, !KeyIsNone(foundKey), keyInstalled, cond);
+            index = LookUp<true>(key, hashValue, foundKey);
+            result = FetchEntry(key, hashValue, index, !KeyIsNone(foundKey), keyInstalled, cond);
 #ifndef NDEBUG
             if (EXPECT_FALSE(cnt == 10000))
                 VERIFY(false, "Fetch hang up\n");
@@ -689,7 +1121,7 @@ namespace NLFHT {
 #else
         while (
 #endif
-        (result = PutEntry(entry, value, cond, updateAliveCnt)) == RETRY
+        (result = PutEntry(index, value, cond, updateAliveCnt)) == RETRY
 #ifndef NDEBUG
 ; ++cnt)
 #else
@@ -705,9 +1137,9 @@ namespace NLFHT {
     }
 
     template <class Prt>
-    void Table<Prt>::DoCopyTask()
+    void Table<Prt>::DoCopyTask(bool byOperation)
     {
-        if (EXPECT_FALSE(m_Parent->m_Head != this))
+        if (EXPECT_FALSE(!m_Parent->IsHead(this)))
         {
             return;
         }
@@ -724,19 +1156,38 @@ namespace NLFHT {
         ForbidPrepareToDelete();
 
         // if table is already thrown away your lock is mistake
-        if (EXPECT_FALSE(m_Parent->m_Head != this))
+        if (EXPECT_FALSE(!m_Parent->IsHead(this)))
         {
             AllowPrepareToDelete();
             return;
         }
 
         // help humanity to copy this fucking table
-        size_t finish = AtomicAdd(m_CopiedCnt, m_CopyTaskSize);
-        size_t start = finish - m_CopyTaskSize;
+        CopyPacer& pacer = m_Parent->m_CopyPacer;
+        const bool paced = pacer.Budget() != 0;
+        size_t taskSize = byOperation && paced ? pacer.TaskSize(m_CopyTaskSize) : m_CopyTaskSize;
+        // new table is full already, budget can't be kept
+        if (EXPECT_FALSE(m_Next->GetNext()))
+            taskSize = Max(taskSize, m_CopyTaskSize);
+        size_t finish = AtomicAdd(m_CopiedCnt, taskSize);
+        size_t start = finish - taskSize;
         if (start < m_Size) {
             finish = Min(m_Size, finish);
-            for (size_t i = start; i < finish; ++i)
-                Copy(&m_Data[i]);
+            if (EXPECT_TRUE(!paced))
+            {
+                for (size_t i = start; i < finish; ++i)
+                    Copy(i);
+            }
+            else
+            {
+                const uint64_t startNs = MonotonicNs();
+                for (size_t i = start; i < finish; ++i)
+                    Copy(i);
+                const uint64_t ns = MonotonicNs() - startNs;
+                pacer.Account(finish - start, ns);
+                if (byOperation)
+                    m_Parent->m_Guard->OnCopyTask(finish - start, ns);
+            }
         }
 
         // your job is done
@@ -751,23 +1202,7 @@ namespace NLFHT {
 #ifdef TRACE
         Trace(Cerr, "PrepareToDelete\n");
 #endif
-        AtomicBase currentTableNumber = m_Parent->m_TableNumber;
-        if (m_Parent->m_Head == this && AtomicCas(&m_Parent->m_Head, m_Next, this)) {
-            // deleted table from main list
-            // now it's only thread that has pointer to it
-            AtomicIncrement(m_Parent->m_TableNumber);
-            m_Parent->m_TableToDeleteNumber = currentTableNumber;
-            while (true) {
-                Table* toDelete = m_Parent->m_HeadToDelete;
-                m_NextToDelete = toDelete;
-                if (AtomicCas(&m_Parent->m_HeadToDelete, this, toDelete)) {
-#ifdef TRACE_MEM
-                    Trace(Cerr, "Scheduled to delete table %zd\n", (size_t)this);
-#endif
-                    break;
-                }
-            }
-        }
+        m_Parent->ThrowAway(this);
     }
 
     // JUST TO DEBUG
@@ -785,14 +1220,51 @@ namespace NLFHT {
         if (!compact) {
             for (size_t i = 0; i < m_Size; ++i)
                 buf << "Entry " << i << ": "
-                    << "(" << KeyToString<Key>((Key)m_Data[i].Key)
-                    << "; " << ValueToString<Value>((Value)m_Data[i].Value)
+                    << "(" << KeyToString<Key>(m_Data.LoadKey(i))
+                    << "; " << ValueToString<Value>(m_Data.LoadValue(i))
                     << ")\n";
         }
 
         ostr << buf.str();
     }
 
+    template <class Owner>
+    void Table<Owner>::CollectProbeStatistics(ProbeStatistics& stats) const {
+        // number of cache lines occupied by keys from begin to end (inclusive), probing wraps
+        struct Lines {
+            const TData& Data;
+            size_t Size;
+
+            size_t operator()(size_t begin, size_t end) const {
+                if (end < begin)
+                    return (*this)(begin, Size - 1) + (*this)(0, end);
+                return (size_t)Data.KeyAddress(end) / CACHE_LINE_SIZE - (size_t)Data.KeyAddress(begin) / CACHE_LINE_SIZE + 1;
+            }
+        } lines = { m_Data, m_Size };
+
+        for (size_t i = 0; i < m_Size; ++i) {
+            const Key key = m_Data.LoadKey(i);
+            if (KeyTraits<Key>::IsReserved(key))
+                continue;
+            ++stats.m_KeyCnt;
+            stats.m_HitCacheLines += lines(HomeIndex(Hash(key)), i);
+        }
+
+        // first empty entry at or after i
+        std::vector<size_t> nextEmpty(m_Size, m_Size);
+        size_t empty = m_Size;
+        for (size_t pass = 0; pass < 2; ++pass)
+            for (size_t i = m_Size; i-- > 0; ) {
+                if (KeyTraits<Key>::IsReserved(m_Data.LoadKey(i)))
+                    empty = i;
+                nextEmpty[i] = empty;
+            }
+        for (size_t home = 0; home < m_Size; home += Policy::BUCKET_SIZE) {
+            ++stats.m_HomeCnt;
+            stats.m_MissCacheLines += nextEmpty[home] < m_Size ? lines(home, nextEmpty[home]) : lines(home, home ? home - 1 : m_Size - 1);
+        }
+    }
+
     template <class Owner>
     void Table<Owner>::Trace(std::ostream& ostr, const char* format, ...) {
         char buf1[10000];
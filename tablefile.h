@@ -0,0 +1,202 @@
+#pragma once
+
+#include "atomic.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace NLFHT
+{
+    // policy knobs, which change how table block is laid out and probed
+    // (see DefaultTablePolicy), table file is opened with the same ones only
+    struct TableFileLayout
+    {
+        uint32_t m_Probing;
+        uint32_t m_Storage;
+        // ZERO_IS_EMPTY, EXACT_SIZE and OCCUPANCY_BITMAP bits
+        uint32_t m_Flags;
+        uint32_t m_BucketSize;
+        uint64_t m_DirtyRegionBytes;
+
+        template <class Policy>
+        static TableFileLayout Of()
+        {
+            const TableFileLayout layout = {
+                Policy::Probing::LAYOUT,
+                Policy::Storage::LAYOUT,
+                (uint32_t)Policy::ZERO_IS_EMPTY | (uint32_t)Policy::EXACT_SIZE << 1 | (uint32_t)Policy::OCCUPANCY_BITMAP << 2,
+                (uint32_t)Policy::BUCKET_SIZE,
+                Policy::DIRTY_REGION_BYTES
+            };
+            return layout;
+        }
+        bool operator == (const TableFileLayout& other) const
+        {
+            return m_Probing == other.m_Probing && m_Storage == other.m_Storage &&
+                   m_Flags == other.m_Flags && m_BucketSize == other.m_BucketSize &&
+                   m_DirtyRegionBytes == other.m_DirtyRegionBytes;
+        }
+    };
+
+    // File of persistent table (see LFHashTable::Open): header page, then table
+    // block as it is in memory. File is mapped shared, so table is changed
+    // in page cache directly and survives restart of process without reload.
+    struct TableFileHeader
+    {
+        // whole page, so table block stays aligned
+        static const size_t SIZE = 4096;
+        static const uint32_t VERSION = 2;
+
+        char m_Magic[8];
+        uint32_t m_Version;
+        // sizeof of pair, guards against opening file of other table type
+        uint32_t m_EntrySize;
+        // files of chain are numbered in order of creation
+        uint64_t m_Number;
+        uint64_t m_TableSize;
+        uint64_t m_AllocSize;
+        // counters of whole table, are valid in the newest file only
+        // and only if it's not changed since LFHashTable::Sync
+        int64_t m_AliveCnt;
+        int64_t m_KeyCnt;
+        uint32_t m_Clean;
+        TableFileLayout m_Layout;
+
+        bool IsValid(uint32_t entrySize) const
+        {
+            return !memcmp(m_Magic, "LFHTTABL", sizeof(m_Magic)) &&
+                   m_Version == VERSION && m_EntrySize == entrySize;
+        }
+    };
+
+    inline void ThrowTableFileError(const std::string& path, const char* what)
+    {
+        throw std::runtime_error("table file " + path + ": " + what + ": " + strerror(errno));
+    }
+
+    class TableFile
+    {
+    public:
+        static std::string Path(const std::string& dir, uint64_t number)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "/table.%llu", (unsigned long long)number);
+            return dir + name;
+        }
+
+        // creates zero-filled file for table block of allocSize bytes and maps it
+        static TableFileHeader* Create(const std::string& dir, uint64_t number, size_t tableSize,
+                                       size_t allocSize, size_t entrySize, const TableFileLayout& layout)
+        {
+            const std::string path = Path(dir, number);
+            const int file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (file < 0)
+                ThrowTableFileError(path, "open");
+            if (ftruncate(file, TableFileHeader::SIZE + allocSize))
+            {
+                close(file);
+                unlink(path.c_str());
+                ThrowTableFileError(path, "truncate");
+            }
+            TableFileHeader* header = Map(path, file, allocSize);
+            memcpy(header->m_Magic, "LFHTTABL", sizeof(header->m_Magic));
+            header->m_Version = TableFileHeader::VERSION;
+            header->m_EntrySize = entrySize;
+            header->m_Number = number;
+            header->m_TableSize = tableSize;
+            header->m_AllocSize = allocSize;
+            header->m_Layout = layout;
+            return header;
+        }
+
+        // maps existing file and checks its header
+        static TableFileHeader* Open(const std::string& dir, uint64_t number, size_t entrySize)
+        {
+            const std::string path = Path(dir, number);
+            const int file = open(path.c_str(), O_RDWR);
+            if (file < 0)
+                ThrowTableFileError(path, "open");
+            const off_t bytes = lseek(file, 0, SEEK_END);
+            TableFileHeader header;
+            if (bytes < (off_t)TableFileHeader::SIZE ||
+                pread(file, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+                !header.IsValid(entrySize) || header.m_Number != number ||
+                (off_t)(TableFileHeader::SIZE + header.m_AllocSize) != bytes)
+            {
+                close(file);
+                errno = EINVAL;
+                ThrowTableFileError(path, "bad format");
+            }
+            return Map(path, file, header.m_AllocSize);
+        }
+
+        static void* Block(TableFileHeader* header)
+        {
+            return (char*)header + TableFileHeader::SIZE;
+        }
+        static TableFileHeader* HeaderOf(void* block)
+        {
+            return (TableFileHeader*)((char*)block - TableFileHeader::SIZE);
+        }
+
+        // writes changed pages to disk
+        static void Sync(const std::string& dir, TableFileHeader* header)
+        {
+            if (msync(header, TableFileHeader::SIZE + header->m_AllocSize, MS_SYNC))
+                ThrowTableFileError(Path(dir, header->m_Number), "msync");
+        }
+        static void Close(TableFileHeader* header)
+        {
+            munmap(header, TableFileHeader::SIZE + header->m_AllocSize);
+        }
+        static void Remove(const std::string& dir, TableFileHeader* header)
+        {
+            const std::string path = Path(dir, header->m_Number);
+            Close(header);
+            unlink(path.c_str());
+        }
+
+        // numbers of table files in dir, ascending
+        static std::vector<uint64_t> List(const std::string& dir)
+        {
+            DIR* d = opendir(dir.c_str());
+            if (!d)
+                ThrowTableFileError(dir, "opendir");
+            std::vector<uint64_t> numbers;
+            while (const dirent* entry = readdir(d))
+            {
+                if (strncmp(entry->d_name, "table.", 6))
+                    continue;
+                char* end;
+                const unsigned long long number = strtoull(entry->d_name + 6, &end, 10);
+                if (entry->d_name[6] && !*end)
+                    numbers.push_back(number);
+            }
+            closedir(d);
+            std::sort(numbers.begin(), numbers.end());
+            return numbers;
+        }
+
+    private:
+        static TableFileHeader* Map(const std::string& path, int file, size_t allocSize)
+        {
+            void* data = mmap(0, TableFileHeader::SIZE + allocSize, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+            close(file);
+            if (data == MAP_FAILED)
+                ThrowTableFileError(path, "mmap");
+            return (TableFileHeader*)data;
+        }
+    };
+}
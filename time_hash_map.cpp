@@ -12,11 +12,13 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "lfht.h"
+#include "segmented.h"
 #include "mutexht.h"
 
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int.hpp>
 #include <boost/random/variate_generator.hpp>
+#include <algorithm>
 #include <map>
 #include <vector>
 #include <thread>
@@ -25,11 +27,19 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/utsname.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+#include <unistd.h>
+#include <string.h>
 #include <iostream>
 #include <fstream>
 #include <unordered_map>
 
 static const int DUMP = 1;
+size_t nThreads = 4;
 
 namespace timer
 {
@@ -217,6 +227,60 @@ cpu_info cpuInfo(void)
 
 } // namespace cpuid
 
+namespace perf
+{
+// page faults of the process and data TLB misses of calling thread;
+// TLB misses are not available if perf events are not permitted
+class counters
+{
+public:
+    counters(void)
+        : _tlbFd(-1)
+    {
+        struct perf_event_attr attr;
+        ::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB
+                    | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _tlbFd = ::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~counters(void)
+    {
+        if (_tlbFd != -1)
+            ::close(_tlbFd);
+    }
+
+    bool hasTlbMisses(void) const
+    { return _tlbFd != -1; }
+
+    long long tlbMisses(void) const
+    {
+        long long result = 0;
+        if (_tlbFd == -1 || ::read(_tlbFd, &result, sizeof(result)) != sizeof(result))
+            return 0;
+        return result;
+    }
+
+    long long pageFaults(void) const
+    {
+        struct rusage usage;
+        ::getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_minflt + usage.ru_majflt;
+    }
+
+private:
+    counters(const counters&);
+    counters& operator=(const counters&);
+
+    int _tlbFd;
+};
+} // namespace perf
+
 std::vector<size_t> g_keys;
 
 void createInput(size_t n_,unsigned seed_)
@@ -252,9 +316,120 @@ struct lf_hash_map_constants
     enum { bucket_count_expand_factor = 4 };  // multiplier for bucket expansion
 };
 
+struct group_probing_policy : NLFHT::DefaultTablePolicy
+{
+    typedef NLFHT::GroupProbing Probing;
+};
+
 typedef LFHashTable<size_t, size_t> lf_hash_map;
+typedef LFHashTable<size_t, size_t, EqualToF<size_t>, HashF<size_t>, EqualToF<size_t>, DEFAULT_ALLOCATOR(size_t),
+                    NLFHT::Proxy<NLFHT::DefaultKeyManager>, NLFHT::Proxy<NLFHT::DefaultValueManager>,
+                    group_probing_policy> lf_hash_map_group;
+struct bucketized_policy : NLFHT::DefaultTablePolicy
+{
+    static const size_t BUCKET_SIZE = CACHE_LINE_SIZE / sizeof(NLFHT::Entry<size_t, size_t>);
+};
+typedef LFHashTable<size_t, size_t, EqualToF<size_t>, HashF<size_t>, EqualToF<size_t>, DEFAULT_ALLOCATOR(size_t),
+                    NLFHT::Proxy<NLFHT::DefaultKeyManager>, NLFHT::Proxy<NLFHT::DefaultValueManager>,
+                    bucketized_policy> lf_hash_map_bucketized;
+struct split_storage_policy : NLFHT::DefaultTablePolicy
+{
+    typedef NLFHT::SplitArrayStorage Storage;
+};
+typedef LFHashTable<size_t, size_t, EqualToF<size_t>, HashF<size_t>, EqualToF<size_t>, DEFAULT_ALLOCATOR(size_t),
+                    NLFHT::Proxy<NLFHT::DefaultKeyManager>, NLFHT::Proxy<NLFHT::DefaultValueManager>,
+                    split_storage_policy> lf_hash_map_split;
+struct huge_page_policy : NLFHT::DefaultTablePolicy
+{
+    typedef NLFHT::HugePageMemory<false> Memory;
+};
+typedef LFHashTable<size_t, size_t, EqualToF<size_t>, HashF<size_t>, EqualToF<size_t>, DEFAULT_ALLOCATOR(size_t),
+                    NLFHT::Proxy<NLFHT::DefaultKeyManager>, NLFHT::Proxy<NLFHT::DefaultValueManager>,
+                    huge_page_policy> lf_hash_map_huge;
+struct huge_page_populated_policy : NLFHT::DefaultTablePolicy
+{
+    typedef NLFHT::HugePageMemory<true> Memory;
+};
+typedef LFHashTable<size_t, size_t, EqualToF<size_t>, HashF<size_t>, EqualToF<size_t>, DEFAULT_ALLOCATOR(size_t),
+                    NLFHT::Proxy<NLFHT::DefaultKeyManager>, NLFHT::Proxy<NLFHT::DefaultValueManager>,
+                    huge_page_populated_policy> lf_hash_map_huge_populated;
+struct zero_is_empty_policy : NLFHT::DefaultTablePolicy
+{
+    static const bool ZERO_IS_EMPTY = true;
+};
+typedef LFHashTable<size_t, size_t, EqualToF<size_t>, HashF<size_t>, EqualToF<size_t>, DEFAULT_ALLOCATOR(size_t),
+                    NLFHT::Proxy<NLFHT::DefaultKeyManager>, NLFHT::Proxy<NLFHT::DefaultValueManager>,
+                    zero_is_empty_policy> lf_hash_map_zero;
+struct exact_size_policy : NLFHT::DefaultTablePolicy
+{
+    static const bool EXACT_SIZE = true;
+};
+typedef LFHashTable<size_t, size_t, EqualToF<size_t>, HashF<size_t>, EqualToF<size_t>, DEFAULT_ALLOCATOR(size_t),
+                    NLFHT::Proxy<NLFHT::DefaultKeyManager>, NLFHT::Proxy<NLFHT::DefaultValueManager>,
+                    exact_size_policy> lf_hash_map_exact;
+struct occupancy_bitmap_policy : NLFHT::DefaultTablePolicy
+{
+    static const bool OCCUPANCY_BITMAP = true;
+};
+typedef LFHashTable<size_t, size_t, EqualToF<size_t>, HashF<size_t>, EqualToF<size_t>, DEFAULT_ALLOCATOR(size_t),
+                    NLFHT::Proxy<NLFHT::DefaultKeyManager>, NLFHT::Proxy<NLFHT::DefaultValueManager>,
+                    occupancy_bitmap_policy> lf_hash_map_occupancy;
+struct dirty_regions_policy : NLFHT::DefaultTablePolicy
+{
+    static const size_t DIRTY_REGION_BYTES = 4096;
+};
+typedef LFHashTable<size_t, size_t, EqualToF<size_t>, HashF<size_t>, EqualToF<size_t>, DEFAULT_ALLOCATOR(size_t),
+                    NLFHT::Proxy<NLFHT::DefaultKeyManager>, NLFHT::Proxy<NLFHT::DefaultValueManager>,
+                    dirty_regions_policy> lf_hash_map_dirty;
+struct shared_memory_policy : NLFHT::DefaultTablePolicy
+{
+    typedef NLFHT::SharedMemory Memory;
+};
+typedef LFHashTable<size_t, size_t, EqualToF<size_t>, HashF<size_t>, EqualToF<size_t>, DEFAULT_ALLOCATOR(size_t),
+                    NLFHT::Proxy<NLFHT::DefaultKeyManager>, NLFHT::Proxy<NLFHT::DefaultValueManager>,
+                    shared_memory_policy> lf_hash_map_shared;
+// const char* keys with strcmp comparator, which counts its calls on strings,
+// so probing engines are compared by comparisons per lookup
+struct counted_str_equal
+{
+    static size_t calls;
+
+    inline bool operator()(const char* a, const char* b) const
+    {
+        // small pointers are reserved keys
+        if (a == b || (size_t)a <= 3 || (size_t)b <= 3)
+            return a == b;
+        ++calls;
+        return !strcmp(a, b);
+    }
+};
+size_t counted_str_equal::calls = 0;
+struct str_hash
+{
+    inline size_t operator()(const char* s) const
+    {
+        size_t hash = 14695981039346656037ULL;
+        for (; *s; ++s)
+            hash = (hash ^ (unsigned char)*s) * 1099511628211ULL;
+        return hash;
+    }
+};
+typedef LFHashTable<const char*, size_t, counted_str_equal, str_hash, EqualToF<size_t>, DEFAULT_ALLOCATOR(size_t),
+                    NLFHT::Proxy<NLFHT::DefaultKeyManager>, NLFHT::Proxy<NLFHT::DefaultValueManager>
+                    > lf_hash_map_str;
+struct stored_hash_policy : NLFHT::DefaultTablePolicy
+{
+    typedef NLFHT::StoredHashProbing Probing;
+};
+typedef LFHashTable<const char*, size_t, counted_str_equal, str_hash, EqualToF<size_t>, DEFAULT_ALLOCATOR(size_t),
+                    NLFHT::Proxy<NLFHT::DefaultKeyManager>, NLFHT::Proxy<NLFHT::DefaultValueManager>,
+                    stored_hash_policy> lf_hash_map_str_stored;
+typedef SegmentedHashTable<size_t, size_t> segmented_hash_map;
 typedef std::unordered_map<size_t, size_t> unordered_map;
 
+#define LF_HASH_MAP_TEMPLATE template <class K, class V, class KC, class HF, class VC, class A, class KM, class VM, class P>
+#define LF_HASH_MAP LFHashTable<K, V, KC, HF, VC, A, KM, VM, P>
+#define SEGMENTED_HASH_MAP SegmentedHashTable<K, V, KC, HF, VC, A, KM, VM, P>
 
 // allow customization of basic hash_map ops - use std::map API
 template<class MapType, class Hint> inline void insert_map(MapType& map_,size_t key_, Hint*) {
@@ -267,13 +442,55 @@ template<class MapType, class Hint> inline bool find_map(MapType& map_,size_t ke
 template<class MapType, class Hint> inline void delete_map(MapType& map_,size_t key_, Hint*) {
     map_.erase(key_);
 }
+template<class MapType, class Hint> inline size_t find_many_map(MapType& map_,const size_t* keys_,size_t n_,Hint* hint_) {
+    size_t r = 0;
+    for (size_t i = 0; i != n_; ++i)
+        r += find_map(map_,keys_[i],hint_);
+    return r;
+}
+template<class MapType, class Hint> inline void insert_many_map(MapType& map_,const size_t* keys_,size_t n_,Hint* hint_) {
+    for (size_t i = 0; i != n_; ++i)
+        insert_map(map_,keys_[i],hint_);
+}
 template<class MapType> inline size_t size(const MapType& map_) {
     return map_.size();
 }
-template<> inline void insert_map<lf_hash_map, lf_hash_map::SearchHint>(lf_hash_map& map_,size_t key_, lf_hash_map::SearchHint* hint) { map_.PutIfAbsent(key_, key_ + 1, hint);  }
-template<> inline bool find_map<lf_hash_map, lf_hash_map::SearchHint>(lf_hash_map& map_,size_t key_, lf_hash_map::SearchHint* hint) {  return map_.Get(key_, hint) != map_.NotFound(); }
-template<> inline void delete_map<lf_hash_map, lf_hash_map::SearchHint>(lf_hash_map& map_,size_t key_, lf_hash_map::SearchHint* hint) { map_.Delete(key_, hint); }
-template<> inline size_t size<lf_hash_map>(const lf_hash_map& map_) { return map_.Size(); }
+template<class MapType> inline void reserve_map(MapType& map_,size_t n_) {
+    map_.reserve(n_);
+}
+LF_HASH_MAP_TEMPLATE inline void insert_map(LF_HASH_MAP& map_,size_t key_, typename LF_HASH_MAP::SearchHint* hint) { map_.PutIfAbsent(key_, key_ + 1, hint);  }
+LF_HASH_MAP_TEMPLATE inline bool find_map(LF_HASH_MAP& map_,size_t key_, typename LF_HASH_MAP::SearchHint* hint) {  return map_.Get(key_, hint) != map_.NotFound(); }
+LF_HASH_MAP_TEMPLATE inline void delete_map(LF_HASH_MAP& map_,size_t key_, typename LF_HASH_MAP::SearchHint* hint) { map_.Delete(key_, hint); }
+LF_HASH_MAP_TEMPLATE inline size_t find_many_map(LF_HASH_MAP& map_,const size_t* keys_,size_t n_,typename LF_HASH_MAP::SearchHint* hint_) {
+    static const size_t batch = 64;
+    size_t values[batch];
+    size_t r = 0;
+    for (size_t i = 0; i < n_; i += batch)
+    {
+        const size_t cnt = std::min(batch, n_ - i);
+        map_.GetMany(keys_ + i, cnt, values, hint_);
+        for (size_t j = 0; j != cnt; ++j)
+            r += values[j] != map_.NotFound();
+    }
+    return r;
+}
+LF_HASH_MAP_TEMPLATE inline void insert_many_map(LF_HASH_MAP& map_,const size_t* keys_,size_t n_,typename LF_HASH_MAP::SearchHint* hint_) {
+    static const size_t batch = 4096;
+    size_t values[batch];
+    for (size_t i = 0; i < n_; i += batch)
+    {
+        const size_t cnt = std::min(batch, n_ - i);
+        for (size_t j = 0; j != cnt; ++j)
+            values[j] = keys_[i + j] + 1;
+        map_.PutIfAbsentMany(keys_ + i, values, cnt, 0, hint_);
+    }
+}
+LF_HASH_MAP_TEMPLATE inline size_t size(const LF_HASH_MAP& map_) { return map_.Size(); }
+LF_HASH_MAP_TEMPLATE inline void reserve_map(LF_HASH_MAP& map_,size_t n_) { map_.Reserve(n_, nThreads); }
+LF_HASH_MAP_TEMPLATE inline void insert_map(SEGMENTED_HASH_MAP& map_,size_t key_, typename SEGMENTED_HASH_MAP::SearchHint* hint) { map_.PutIfAbsent(key_, key_ + 1, hint);  }
+LF_HASH_MAP_TEMPLATE inline bool find_map(SEGMENTED_HASH_MAP& map_,size_t key_, typename SEGMENTED_HASH_MAP::SearchHint* hint) {  return map_.Get(key_, hint) != map_.NotFound(); }
+LF_HASH_MAP_TEMPLATE inline void delete_map(SEGMENTED_HASH_MAP& map_,size_t key_, typename SEGMENTED_HASH_MAP::SearchHint* hint) { map_.Delete(key_, hint); }
+LF_HASH_MAP_TEMPLATE inline size_t size(const SEGMENTED_HASH_MAP& map_) { return map_.Size(); }
 
 template<typename MapType>
 struct TRegistration {
@@ -283,12 +500,23 @@ struct TRegistration {
     }
 };
 
-template<>
-struct TRegistration<lf_hash_map> {
+LF_HASH_MAP_TEMPLATE
+struct TRegistration<LF_HASH_MAP> {
     TLFHTRegistration m_registration;
-    typedef lf_hash_map::SearchHint Hint;
+    typedef typename LF_HASH_MAP::SearchHint Hint;
 
-    TRegistration(lf_hash_map& map)
+    TRegistration(LF_HASH_MAP& map)
+        : m_registration(map)
+    {
+    }
+};
+
+LF_HASH_MAP_TEMPLATE
+struct TRegistration<SEGMENTED_HASH_MAP> {
+    TLFHTRegistration m_registration;
+    typedef typename SEGMENTED_HASH_MAP::SearchHint Hint;
+
+    TRegistration(SEGMENTED_HASH_MAP& map)
         : m_registration(map)
     {
     }
@@ -354,6 +582,43 @@ static void time_map_grow_predicted(size_t iters_)
     report("map_predict_grow",timer.elapsedTime(),iters_);
 }
 
+// the first percent of keys is inserted into growing map, then map is
+// reserved for the rest, reserve time is included
+template<class MapType,int Flags>
+static void time_map_grow_reserved(size_t iters_)
+{
+    MapType map;
+    TRegistration<MapType> registration(map);
+    typename TRegistration<MapType>::Hint hint;
+    const size_t before = iters_/100;
+    for (size_t i = 0; i != before; ++i)
+    {
+        insert_map(map,g_keys[i], &hint);
+    }
+
+    elapsed_timer timer;
+    timer.reset();
+    reserve_map(map,iters_);
+    for (size_t i = before; i != iters_; ++i)
+    {
+        insert_map(map,g_keys[i], &hint);
+    }
+    report("map_reserve_grow",timer.elapsedTime(),iters_ - before);
+}
+
+template<class MapType,int Flags>
+static void time_map_grow_predicted_many(size_t iters_)
+{
+    MapType map(iters_);
+    TRegistration<MapType> registration(map);
+    typename TRegistration<MapType>::Hint hint;
+    elapsed_timer timer;
+
+    timer.reset();
+    insert_many_map(map,&g_keys[0],iters_,&hint);
+    report("map_predict_grow_many",timer.elapsedTime(),iters_);
+}
+
 template<class MapType,int Flags>
 static void time_map_find(size_t iters_)
 {
@@ -380,6 +645,28 @@ static void time_map_find(size_t iters_)
     std::cout << "r value: " << r << std::endl;
 }
 
+template<class MapType,int Flags>
+static void time_map_find_many(size_t iters_)
+{
+    MapType map;
+    TRegistration<MapType> registration(map);
+    typename TRegistration<MapType>::Hint hint;
+    elapsed_timer timer;
+    size_t r;
+    size_t i;
+
+    for (i = 0; i != iters_; ++i)
+    {
+        insert_map(map,g_keys[i], &hint);
+    }
+
+    find_map(map,g_keys[0], &hint);
+    timer.reset();
+    r = find_many_map(map,&g_keys[0],iters_,&hint);
+    report("map_find_many",timer.elapsedTime(),iters_);
+    std::cout << "r value: " << r << std::endl;
+}
+
 template<class MapType,int Flags>
 static void time_map_erase(size_t iters_)
 {
@@ -414,7 +701,10 @@ static void measure_st_map(const std::string& mapString_,size_t nLoops_,size_t i
         std::cout << std::endl << mapString_ << std::endl;
         time_map_grow<MapType,Flags>(iters_);
         time_map_grow_predicted<MapType,Flags>(iters_);
+        time_map_grow_reserved<MapType,Flags>(iters_);
+        time_map_grow_predicted_many<MapType,Flags>(iters_);
         time_map_find<MapType,Flags>(iters_);
+        time_map_find_many<MapType,Flags>(iters_);
         time_map_erase<MapType,Flags>(iters_);
     }
 }
@@ -466,8 +756,6 @@ void mtTestThreadEntryPoint(MapType& map_,pthread::barrier& barrier_,unsigned se
     elapsedTime_ = timer.elapsedTime();
 }
 
-size_t nThreads = 4;
-
 template<class MapType,int Flags>
 void mtTest(MapType& map_,const std::string& test_)
 {
@@ -525,6 +813,694 @@ void measure_mt_map(const std::string& mapString_)
     }
 }
 
+// compares entries layouts: lookup time and cache lines touched per lookup,
+// page faults during inserts and TLB misses during lookups
+template<class MapType>
+static void time_map_layout(const std::string& mapString_,size_t n_)
+{
+    perf::counters counters;
+    long long faults = counters.pageFaults();
+    elapsed_timer timer;
+
+    timer.reset();
+    MapType map(n_);
+    const double createTime = timer.elapsedTime();
+    TRegistration<MapType> registration(map);
+    typename TRegistration<MapType>::Hint hint;
+    size_t i;
+    size_t r = 0;
+
+    for (i = 1; i <= n_; ++i)
+    {
+        insert_map(map,i,&hint);
+    }
+    faults = counters.pageFaults() - faults;
+
+    long long tlbMisses = counters.tlbMisses();
+    timer.reset();
+    for (i = 1; i <= n_; ++i)
+    {
+        r += find_map(map,i,&hint);
+    }
+    const double hitTime = timer.elapsedTime();
+
+    timer.reset();
+    for (i = n_ + 1; i <= 2*n_; ++i)
+    {
+        r += find_map(map,i,&hint);
+    }
+    const double missTime = timer.elapsedTime();
+    tlbMisses = counters.tlbMisses() - tlbMisses;
+
+    const NLFHT::ProbeStatistics stats = map.CollectProbeStatistics();
+    std::cout << mapString_ << " keys " << n_
+              << "\n create " << createTime*1e3 << " ms"
+              << "\n hit  " << hitTime*1e9/n_ << " ns, " << stats.HitCacheLinesPerLookUp() << " cache lines"
+              << "\n miss " << missTime*1e9/n_ << " ns, " << stats.MissCacheLinesPerLookUp() << " cache lines"
+              << "\n memory " << map.AllocatedBytes() / (1 << 20) << " MB"
+              << "\n page faults (create and insert) " << faults;
+    if (counters.hasTlbMisses())
+        std::cout << "\n dTLB misses per lookup " << (double)tlbMisses/(2*n_);
+    else
+        std::cout << "\n dTLB misses n/a";
+    std::cout << "\n r value: " << r
+              << std::endl;
+}
+
+// probing engines on const char* keys: lookup time and string comparisons per lookup
+template<class MapType>
+static void time_map_str_layout(const std::string& mapString_,const std::vector<std::string>& keys_)
+{
+    const size_t n = keys_.size() / 2;
+    elapsed_timer timer;
+    MapType map(n);
+    TRegistration<MapType> registration(map);
+    typename TRegistration<MapType>::Hint hint;
+    size_t i;
+    size_t r = 0;
+
+    timer.reset();
+    for (i = 0; i != n; ++i)
+        map.Put(keys_[i].c_str(),i + 1,&hint);
+    const double insertTime = timer.elapsedTime();
+
+    // other copies of strings, so comparator can't stop on equal pointers
+    const std::vector<std::string> probes(keys_);
+    counted_str_equal::calls = 0;
+    timer.reset();
+    for (i = 0; i != n; ++i)
+        r += map.Get(probes[i].c_str(),&hint) == i + 1;
+    const double hitTime = timer.elapsedTime();
+    const size_t hitCalls = counted_str_equal::calls;
+
+    counted_str_equal::calls = 0;
+    timer.reset();
+    for (i = n; i != 2*n; ++i)
+        r += map.Get(probes[i].c_str(),&hint) != map.NotFound();
+    const double missTime = timer.elapsedTime();
+    const size_t missCalls = counted_str_equal::calls;
+
+    std::cout << mapString_ << " keys " << n
+              << "\n insert " << insertTime*1e9/n << " ns"
+              << "\n hit  " << hitTime*1e9/n << " ns, " << (double)hitCalls/n << " string comparisons"
+              << "\n miss " << missTime*1e9/n << " ns, " << (double)missCalls/n << " string comparisons"
+              << "\n memory " << map.AllocatedBytes() / (1 << 20) << " MB"
+              << "\n r value: " << r
+              << std::endl;
+}
+
+static void measure_layouts(void)
+{
+    const size_t strSizes[] = { 1000000, 10000000 };
+    for (size_t i = 0; i != sizeof(strSizes)/sizeof(strSizes[0]); ++i)
+    {
+        // the second half is absent from maps
+        std::vector<std::string> keys;
+        for (size_t k = 0; k != 2*strSizes[i]/DUMP; ++k)
+            keys.push_back("key-" + std::to_string(k * 7919));
+        std::cout << std::endl;
+        time_map_str_layout<lf_hash_map_str>("lockfree::lf_hash_map_str",keys);
+        time_map_str_layout<lf_hash_map_str_stored>("lockfree::lf_hash_map_str_stored",keys);
+    }
+
+    const size_t sizes[] = { 1000000, 25000000, 100000000 };
+    for (size_t i = 0; i != sizeof(sizes)/sizeof(sizes[0]); ++i)
+    {
+        std::cout << std::endl;
+        time_map_layout<lf_hash_map>("lockfree::lf_hash_map",sizes[i]/DUMP);
+        time_map_layout<lf_hash_map_bucketized>("lockfree::lf_hash_map_bucketized",sizes[i]/DUMP);
+        time_map_layout<lf_hash_map_split>("lockfree::lf_hash_map_split",sizes[i]/DUMP);
+        time_map_layout<lf_hash_map_huge>("lockfree::lf_hash_map_huge",sizes[i]/DUMP);
+        time_map_layout<lf_hash_map_huge_populated>("lockfree::lf_hash_map_huge_populated",sizes[i]/DUMP);
+        time_map_layout<lf_hash_map_zero>("lockfree::lf_hash_map_zero",sizes[i]/DUMP);
+        time_map_layout<lf_hash_map_exact>("lockfree::lf_hash_map_exact",sizes[i]/DUMP);
+    }
+}
+
+// latency of inserts into growing map, migration is done by inserting thread
+// itself or by background threads
+template<class MapType>
+static void time_map_migration(const std::string& mapString_,size_t n_,size_t migrationThreads_,size_t copyBudget_)
+{
+    MapType map;
+    map.SetCopyBudget(copyBudget_);
+    if (migrationThreads_)
+        map.StartMigrationThreads(migrationThreads_);
+    TRegistration<MapType> registration(map);
+    typename TRegistration<MapType>::Hint hint;
+    timer::clock_timer clock;
+    std::vector<long long> latencies(n_);
+
+    elapsed_timer timer;
+    timer.reset();
+    for (size_t i = 0; i != n_; ++i)
+    {
+        const long long start = clock.absoluteTime();
+        insert_map(map,g_keys[i],&hint);
+        latencies[i] = clock.absoluteTime() - start;
+    }
+    const double elapsedTime = timer.elapsedTime();
+    map.WaitForMigration();
+    map.StopMigrationThreads();
+
+    const NLFHT::CopyStatistics copyStats = map.GetCopyStatistics();
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << mapString_ << " migration threads " << migrationThreads_
+              << ", copy budget " << copyBudget_ << " ns"
+              << "\n total " << elapsedTime << " secs"
+              << "\n p50 " << latencies[n_/2] << " ns"
+              << ", p99 " << latencies[n_ - n_/100] << " ns"
+              << ", p99.9 " << latencies[n_ - n_/1000] << " ns"
+              << ", max " << latencies[n_ - 1] << " ns";
+    // copy tasks are timed with budget only
+    if (copyBudget_)
+        std::cout << "\n copy tasks " << copyStats.m_TaskCnt
+                  << ", " << copyStats.NsPerTask() << " ns per task"
+                  << ", p99 below " << copyStats.QuantileNs(0.99) << " ns"
+                  << ", max " << copyStats.m_MaxNs << " ns"
+                  << ", " << copyStats.NsPerEntry() << " ns per entry";
+    std::cout << "\n size " << size(map)
+              << std::endl;
+}
+
+// latency of inserts and peak memory of map growing from the smallest size:
+// whole table copies against segment splits
+template<class MapType>
+static void time_map_growth(const std::string& mapString_,size_t n_)
+{
+    static const size_t memory_step = 1 << 16;
+
+    MapType map;
+    TRegistration<MapType> registration(map);
+    typename TRegistration<MapType>::Hint hint;
+    timer::clock_timer clock;
+    std::vector<long long> latencies(n_);
+    size_t peakBytes = 0;
+
+    elapsed_timer timer;
+    timer.reset();
+    for (size_t i = 0; i != n_; ++i)
+    {
+        const long long start = clock.absoluteTime();
+        insert_map(map,g_keys[i],&hint);
+        latencies[i] = clock.absoluteTime() - start;
+        if (i % memory_step == 0)
+            peakBytes = std::max(peakBytes, map.AllocatedBytes());
+    }
+    const double elapsedTime = timer.elapsedTime();
+    peakBytes = std::max(peakBytes, map.AllocatedBytes());
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << mapString_
+              << "\n total " << elapsedTime << " secs"
+              << "\n p50 " << latencies[n_/2] << " ns"
+              << ", p99 " << latencies[n_ - n_/100] << " ns"
+              << ", p99.9 " << latencies[n_ - n_/1000] << " ns"
+              << ", max " << latencies[n_ - 1] << " ns"
+              << "\n peak memory " << peakBytes/(1 << 20) << " MB"
+              << ", final " << map.AllocatedBytes()/(1 << 20) << " MB"
+              << "\n size " << size(map)
+              << std::endl;
+}
+
+// writer of time_map_iterate: puts new keys and deletes them later, so map is resized
+template<class MapType>
+static void iterateWriterEntryPoint(MapType& map_,size_t base_,volatile bool& stop_)
+{
+    TRegistration<MapType> registration(map_);
+    typename TRegistration<MapType>::Hint hint;
+    static const size_t window = 1 << 16;
+    for (size_t i = 0; !stop_; ++i)
+    {
+        insert_map(map_,base_ + i,&hint);
+        if (i >= window)
+            delete_map(map_,base_ + i - window,&hint);
+    }
+}
+
+struct count_key {
+    size_t operator()(size_t, size_t) const { return 1; }
+};
+struct plus {
+    size_t operator()(size_t a_, size_t b_) const { return a_ + b_; }
+};
+
+// scan of map by guarded iterator and by parallel pass, while writers modify it
+template<class MapType>
+static void time_map_iterate(const std::string& mapString_,size_t n_)
+{
+    MapType map;
+    TRegistration<MapType> registration(map);
+    typename TRegistration<MapType>::Hint hint;
+    for (size_t i = 0; i != n_; ++i)
+        insert_map(map,i + 1,&hint);
+
+    elapsed_timer timer;
+    timer.reset();
+    size_t quietVisited = 0;
+    for (typename MapType::GuardedIterator it(map); it.IsValid(); ++it)
+        ++quietVisited;
+    const double quietTime = timer.elapsedTime();
+
+    timer.reset();
+    const size_t parallelVisited = map.ParallelReduce((size_t)0,count_key(),plus(),nThreads);
+    const double parallelTime = timer.elapsedTime();
+
+    volatile bool stop = false;
+    std::vector<std::thread> writers;
+    for (size_t i = 0; i != nThreads; ++i)
+        writers.push_back(std::thread(&iterateWriterEntryPoint<MapType>,std::ref(map),(i + 1) << 40,std::ref(stop)));
+
+    timer.reset();
+    size_t visited = 0;
+    size_t stableVisited = 0;
+    for (typename MapType::GuardedIterator it(map); it.IsValid(); ++it)
+    {
+        ++visited;
+        stableVisited += it.Key() <= n_;
+    }
+    const double busyTime = timer.elapsedTime();
+    stop = true;
+    for (size_t i = 0; i != writers.size(); ++i)
+        writers[i].join();
+
+    std::cout << mapString_
+              << "\n without writers " << quietVisited << " keys in " << quietTime << " secs"
+              << ", by " << nThreads << " threads in " << parallelTime << " secs (" << parallelVisited << " keys)"
+              << "\n with " << nThreads << " writers " << visited << " keys in " << busyTime << " secs"
+              << ", " << stableVisited << " of " << n_ << " initial keys"
+              << std::endl;
+}
+
+// scan of map presized for n keys, which holds one percent of them
+template<class MapType>
+static void time_map_sparse_scan(const std::string& mapString_,size_t n_)
+{
+    MapType map(n_);
+    TRegistration<MapType> registration(map);
+    typename TRegistration<MapType>::Hint hint;
+    for (size_t i = 0; i != n_/100; ++i)
+        insert_map(map,g_keys[i],&hint);
+
+    elapsed_timer timer;
+    timer.reset();
+    size_t visited = 0;
+    for (typename MapType::GuardedIterator it(map); it.IsValid(); ++it)
+        ++visited;
+    std::cout << mapString_ << " sparse scan " << visited << " keys in " << timer.elapsedTime() << " secs" << std::endl;
+}
+
+// puts of writer of time_map_consistent, each counter on its own cache line
+struct put_counter {
+    volatile size_t m_puts;
+    char m_padding[64];
+};
+
+// writer of time_map_consistent: rewrites values of existing keys
+template<class MapType>
+static void consistentWriterEntryPoint(MapType& map_,size_t n_,size_t base_,put_counter& counter_,volatile bool& stop_)
+{
+    TRegistration<MapType> registration(map_);
+    typename TRegistration<MapType>::Hint hint;
+    for (size_t i = 0; !stop_; ++i)
+    {
+        map_.Put(g_keys[i % n_],base_ + i,&hint);
+        ++counter_.m_puts;
+    }
+}
+
+template<class MapType>
+static size_t total_puts(const std::vector<put_counter>& counters_)
+{
+    size_t result = 0;
+    for (size_t i = 0; i != counters_.size(); ++i)
+        result += counters_[i].m_puts;
+    return result;
+}
+
+// writers throughput during point-in-time scan against quiet time and weakly consistent scan
+template<class MapType>
+static void time_map_consistent(const std::string& mapString_,size_t n_)
+{
+    MapType map;
+    TRegistration<MapType> registration(map);
+    typename TRegistration<MapType>::Hint hint;
+    for (size_t i = 0; i != n_; ++i)
+        insert_map(map,g_keys[i],&hint);
+
+    volatile bool stop = false;
+    std::vector<put_counter> counters(nThreads);
+    std::vector<std::thread> writers;
+    for (size_t i = 0; i != nThreads; ++i)
+    {
+        counters[i].m_puts = 0;
+        writers.push_back(std::thread(&consistentWriterEntryPoint<MapType>,std::ref(map),n_,(i + 1) << 40,
+                                      std::ref(counters[i]),std::ref(stop)));
+    }
+
+    elapsed_timer timer;
+    timer.reset();
+    size_t puts = total_puts<MapType>(counters);
+    sleep(1);
+    const double quietTime = timer.elapsedTime();
+    const size_t quietPuts = total_puts<MapType>(counters) - puts;
+
+    timer.reset();
+    puts = total_puts<MapType>(counters);
+    size_t weakVisited = 0;
+    for (typename MapType::GuardedIterator it(map); it.IsValid(); ++it)
+        ++weakVisited;
+    const double weakTime = timer.elapsedTime();
+    const size_t weakPuts = total_puts<MapType>(counters) - puts;
+
+    elapsed_timer freezeTimer;
+    timer.reset();
+    freezeTimer.reset();
+    puts = total_puts<MapType>(counters);
+    size_t visited = 0;
+    double freezeTime;
+    {
+        typename MapType::ConsistentIterator it(map);
+        freezeTime = freezeTimer.elapsedTime();
+        for (; it.IsValid(); ++it)
+            ++visited;
+    }
+    const double consistentTime = timer.elapsedTime();
+    const size_t consistentPuts = total_puts<MapType>(counters) - puts;
+
+    stop = true;
+    for (size_t i = 0; i != writers.size(); ++i)
+        writers[i].join();
+
+    std::cout << mapString_ << ", " << nThreads << " writers"
+              << "\n quiet " << quietPuts / quietTime / 1e6 << " M puts/sec"
+              << "\n weakly consistent scan " << weakVisited << " keys in " << weakTime << " secs, "
+              << weakPuts / weakTime / 1e6 << " M puts/sec"
+              << "\n point-in-time scan " << visited << " keys in " << consistentTime << " secs, "
+              << consistentPuts / consistentTime / 1e6 << " M puts/sec, freezing " << freezeTime << " secs"
+              << std::endl;
+}
+
+// rebuild of map by inserts against save and load of snapshot
+template<class MapType>
+static void time_map_snapshot(const std::string& mapString_,size_t n_)
+{
+    static const char* path = "time_hash_map.snapshot";
+
+    MapType map;
+    TRegistration<MapType> registration(map);
+    typename TRegistration<MapType>::Hint hint;
+    elapsed_timer timer;
+    timer.reset();
+    for (size_t i = 0; i != n_; ++i)
+        insert_map(map,g_keys[i],&hint);
+    const double insertTime = timer.elapsedTime();
+
+    timer.reset();
+    map.SaveSnapshot(path, nThreads);
+    const double saveTime = timer.elapsedTime();
+
+    MapType loaded;
+    TRegistration<MapType> loadedRegistration(loaded);
+    timer.reset();
+    loaded.LoadSnapshot(path);
+    const double loadTime = timer.elapsedTime();
+    unlink(path);
+
+    std::cout << mapString_
+              << "\n inserts " << insertTime << " secs"
+              << "\n save by " << nThreads << " threads " << saveTime << " secs"
+              << "\n load " << loadTime << " secs, " << size(loaded) / loadTime / 1e6 << " M keys/sec"
+              << "\n size " << size(loaded)
+              << std::endl;
+}
+
+static size_t file_size(const char* path_)
+{
+    struct stat st;
+    return stat(path_,&st) ? 0 : st.st_size;
+}
+
+// full snapshot against deltas after 0.01 and 1 percent of keys changed, and restore from them
+template<class MapType>
+static void time_map_delta(const std::string& mapString_,size_t n_)
+{
+    static const char* basePath = "time_hash_map.snapshot";
+    static const char* deltaPaths[] = {"time_hash_map.delta0", "time_hash_map.delta1"};
+    static const size_t steps[] = {10000, 100};
+
+    MapType map;
+    TRegistration<MapType> registration(map);
+    typename TRegistration<MapType>::Hint hint;
+    elapsed_timer timer;
+    timer.reset();
+    for (size_t i = 0; i != n_; ++i)
+        insert_map(map,g_keys[i],&hint);
+    const double insertTime = timer.elapsedTime();
+
+    timer.reset();
+    map.SaveSnapshot(basePath, nThreads);
+    const double saveTime = timer.elapsedTime();
+
+    std::cout << mapString_
+              << "\n inserts " << insertTime << " secs"
+              << "\n save " << saveTime << " secs, " << file_size(basePath) / 1e6 << " MB";
+
+    for (size_t d = 0; d != 2; ++d)
+    {
+        // every tenth change is delete
+        for (size_t i = 0; i < n_; i += steps[d])
+            if (i % (10 * steps[d]))
+                map.Put(g_keys[i],i + 1,&hint);
+            else
+                delete_map(map,g_keys[i],&hint);
+        timer.reset();
+        map.WriteDelta(deltaPaths[d]);
+        std::cout << "\n delta of " << n_ / steps[d] << " changes " << timer.elapsedTime() << " secs, "
+                  << file_size(deltaPaths[d]) / 1e6 << " MB";
+    }
+
+    MapType loaded;
+    TRegistration<MapType> loadedRegistration(loaded);
+    timer.reset();
+    loaded.LoadSnapshot(basePath);
+    for (size_t d = 0; d != 2; ++d)
+        loaded.ApplyDelta(deltaPaths[d]);
+    std::cout << "\n load and apply " << timer.elapsedTime() << " secs, size " << size(loaded) << " of " << size(map)
+              << std::endl;
+    unlink(basePath);
+    for (size_t d = 0; d != 2; ++d)
+        unlink(deltaPaths[d]);
+}
+
+// restart of map, which lives in files, against load of snapshot
+template<class MapType>
+static void time_map_persist(const std::string& mapString_,size_t n_)
+{
+    static const char* dir = "time_hash_map.tables";
+    static const char* path = "time_hash_map.snapshot";
+
+    mkdir(dir,0755);
+    double insertTime;
+    {
+        MapType map;
+        TRegistration<MapType> registration(map);
+        typename TRegistration<MapType>::Hint hint;
+        map.Open(dir);
+        elapsed_timer timer;
+        timer.reset();
+        for (size_t i = 0; i != n_; ++i)
+            insert_map(map,g_keys[i],&hint);
+        map.WaitForMigration();
+        insertTime = timer.elapsedTime();
+        map.SaveSnapshot(path);
+    }
+
+    elapsed_timer timer;
+    double openTime;
+    double getTime;
+    size_t reopenedSize;
+    size_t found = 0;
+    {
+        timer.reset();
+        MapType reopened;
+        TRegistration<MapType> reopenedRegistration(reopened);
+        reopened.Open(dir);
+        openTime = timer.elapsedTime();
+        reopenedSize = size(reopened);
+        timer.reset();
+        for (size_t i = 0; i != n_; ++i)
+            found += reopened.Get(g_keys[i]) != MapType::NotFound();
+        getTime = timer.elapsedTime();
+    }
+    const std::vector<uint64_t> numbers = NLFHT::TableFile::List(dir);
+    for (size_t i = 0; i != numbers.size(); ++i)
+        unlink(NLFHT::TableFile::Path(dir,numbers[i]).c_str());
+    rmdir(dir);
+
+    MapType loaded;
+    TRegistration<MapType> loadedRegistration(loaded);
+    timer.reset();
+    loaded.LoadSnapshot(path);
+    const double loadTime = timer.elapsedTime();
+    unlink(path);
+
+    std::cout << mapString_
+              << "\n inserts into files " << insertTime << " secs"
+              << "\n open " << openTime << " secs, size " << reopenedSize
+              << "\n gets after open " << getTime << " secs, found " << found
+              << "\n load of snapshot " << loadTime << " secs"
+              << std::endl;
+}
+
+// one map in SharedMemory, read and updated by nThreads forked processes
+template<class MapType>
+static void time_map_shared(const std::string& mapString_,size_t n_)
+{
+    // region is address space only, pages are taken on first touch,
+    // so it is as big as physical memory, which runs out first anyway
+    NLFHT::SharedMemory::Reserve((size_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE));
+    MapType* map = new (NLFHT::SharedMemory::Allocate(sizeof(MapType))) MapType;
+    {
+        TRegistration<MapType> registration(*map);
+        typename TRegistration<MapType>::Hint hint;
+        for (size_t i = 0; i != n_; ++i)
+            insert_map(*map,g_keys[i],&hint);
+        map->WaitForMigration();
+    }
+    const size_t tableBytes = map->AllocatedBytes();
+
+    // gets, then updates of existing keys, times of processes
+    double* times = (double*)NLFHT::SharedMemory::Allocate(2 * nThreads * sizeof(double));
+    std::vector<pid_t> processes;
+    for (size_t p = 0; p != nThreads; ++p)
+    {
+        const pid_t pid = fork();
+        if (pid)
+        {
+            processes.push_back(pid);
+            continue;
+        }
+        size_t found = 0;
+        {
+            // threads are registered after fork, each process has its own guards
+            TRegistration<MapType> registration(*map);
+            typename TRegistration<MapType>::Hint hint;
+            elapsed_timer timer;
+            timer.reset();
+            for (size_t i = p; i < n_; i += nThreads)
+                found += find_map(*map,g_keys[i],&hint);
+            times[2 * p] = timer.elapsedTime();
+            timer.reset();
+            for (size_t i = p; i < n_; i += nThreads)
+                map->Put(g_keys[i],i + 1,&hint);
+            times[2 * p + 1] = timer.elapsedTime();
+        }
+        _exit(found == (n_ - p + nThreads - 1) / nThreads ? 0 : 1);
+    }
+    bool ok = true;
+    for (size_t p = 0; p != processes.size(); ++p)
+    {
+        int status;
+        waitpid(processes[p],&status,0);
+        // killed process didn't forget its threads, its guards would keep old tables forever
+        if (!WIFEXITED(status))
+            map->GuardManagerRef().ReleaseGuardsOf(processes[p]);
+        ok = ok && WIFEXITED(status) && !WEXITSTATUS(status);
+    }
+    double getTime = 0;
+    double putTime = 0;
+    for (size_t p = 0; p != nThreads; ++p)
+    {
+        getTime = std::max(getTime,times[2 * p]);
+        putTime = std::max(putTime,times[2 * p + 1]);
+    }
+
+    std::cout << mapString_ << " with " << nThreads << " processes"
+              << "\n gets " << n_ / getTime / 1e6 << " M ops/sec" << (ok ? "" : ", KEYS LOST")
+              << "\n updates " << n_ / putTime / 1e6 << " M ops/sec"
+              << "\n tables " << tableBytes / 1e6 << " MB shared against " << nThreads * tableBytes / 1e6
+              << " MB of private copies, region used " << NLFHT::SharedMemory::UsedBytes() / 1e6 << " MB"
+              << std::endl;
+    map->~MapType();
+}
+
+// lookups in map against its frozen copy, and thaw back
+template<class MapType>
+static void time_map_frozen(const std::string& mapString_,size_t n_)
+{
+    MapType map;
+    TRegistration<MapType> registration(map);
+    typename TRegistration<MapType>::Hint hint;
+    for (size_t i = 0; i != n_; ++i)
+        insert_map(map,g_keys[i],&hint);
+    map.WaitForMigration();
+
+    elapsed_timer timer;
+    timer.reset();
+    size_t found = 0;
+    for (size_t i = 0; i != n_; ++i)
+        found += find_map(map,g_keys[i],&hint);
+    const double getTime = timer.elapsedTime();
+
+    timer.reset();
+    const typename MapType::FrozenTable frozen = map.Freeze();
+    const double freezeTime = timer.elapsedTime();
+    timer.reset();
+    size_t frozenFound = 0;
+    for (size_t i = 0; i != n_; ++i)
+        frozenFound += frozen.Find(g_keys[i]) != 0;
+    const double frozenGetTime = timer.elapsedTime();
+
+    MapType thawed;
+    TRegistration<MapType> thawedRegistration(thawed);
+    timer.reset();
+    thawed.Thaw(frozen);
+    const double thawTime = timer.elapsedTime();
+
+    std::cout << mapString_
+              << "\n gets " << n_ / getTime / 1e6 << " M ops/sec, found " << found
+              << "\n freeze " << freezeTime << " secs"
+              << "\n frozen gets " << n_ / frozenGetTime / 1e6 << " M ops/sec, found " << frozenFound
+              << "\n thaw " << thawTime << " secs, size " << size(thawed)
+              << "\n bytes per key " << (double)map.AllocatedBytes() / size(map)
+              << ", frozen " << (double)frozen.AllocatedBytes() / frozen.Size()
+              << std::endl;
+}
+
+// memory of map after mass delete, shrunk by deletes themselves and by ShrinkToFit
+template<class MapType>
+static void time_map_shrink(const std::string& mapString_,size_t n_)
+{
+    MapType map;
+    TRegistration<MapType> registration(map);
+    typename TRegistration<MapType>::Hint hint;
+    for (size_t i = 0; i != n_; ++i)
+        insert_map(map,g_keys[i],&hint);
+    map.WaitForMigration();
+    const size_t fullBytes = map.AllocatedBytes();
+
+    elapsed_timer timer;
+    timer.reset();
+    for (size_t i = 0; i != n_; ++i)
+        if (i % 100)
+            delete_map(map,g_keys[i],&hint);
+    map.WaitForMigration();
+    const double deleteTime = timer.elapsedTime();
+    const size_t deletedBytes = map.AllocatedBytes();
+
+    timer.reset();
+    map.ShrinkToFit();
+    const double shrinkTime = timer.elapsedTime();
+
+    std::cout << mapString_
+              << "\n full " << fullBytes/(1 << 20) << " MB"
+              << "\n after deleting 99% " << deletedBytes/(1 << 10) << " KB in " << deleteTime << " secs"
+              << "\n after ShrinkToFit " << map.AllocatedBytes()/(1 << 10) << " KB in " << shrinkTime << " secs"
+              << "\n size " << size(map)
+              << std::endl;
+}
+
 int main(int argc_,char **argv_)
 {
     /*
@@ -538,9 +1514,102 @@ int main(int argc_,char **argv_)
     print_system_info();
     nThreads = (argc_ == 1) ? 4 : ::atoi(argv_[1]);
 
+    // ./test <threads> layout - only compare entries layouts
+    if (argc_ > 2 && std::string(argv_[2]) == "layout")
+    {
+        std::cout << "ENTRIES LAYOUT TEST" << std::endl;
+        measure_layouts();
+        return 0;
+    }
+
     size_t iters = default_iters;
     createInput(iters, 1);
 
+    // ./test <threads> migration - latencies of inserts during resizes
+    if (argc_ > 2 && std::string(argv_[2]) == "migration")
+    {
+        std::cout << "MIGRATION TEST" << std::endl;
+        time_map_migration<lf_hash_map>("lockfree::lf_hash_map",iters,0,0);
+        time_map_migration<lf_hash_map>("lockfree::lf_hash_map",iters,0,500);
+        time_map_migration<lf_hash_map>("lockfree::lf_hash_map",iters,nThreads,0);
+        return 0;
+    }
+
+    // ./test <threads> growth - whole table copies against segment splits
+    if (argc_ > 2 && std::string(argv_[2]) == "growth")
+    {
+        std::cout << "GROWTH TEST" << std::endl;
+        time_map_growth<lf_hash_map>("lockfree::lf_hash_map",iters);
+        time_map_growth<segmented_hash_map>("lockfree::segmented_hash_map",iters);
+        return 0;
+    }
+
+    // ./test <threads> iterate - scan while writers resize map
+    if (argc_ > 2 && std::string(argv_[2]) == "iterate")
+    {
+        std::cout << "ITERATE TEST" << std::endl;
+        time_map_iterate<lf_hash_map>("lockfree::lf_hash_map",iters/10);
+        time_map_sparse_scan<lf_hash_map>("lockfree::lf_hash_map",iters);
+        time_map_sparse_scan<lf_hash_map_occupancy>("lockfree::lf_hash_map_occupancy",iters);
+        return 0;
+    }
+
+    // ./test <threads> snapshot - save and load of snapshot file
+    if (argc_ > 2 && std::string(argv_[2]) == "snapshot")
+    {
+        std::cout << "SNAPSHOT TEST" << std::endl;
+        time_map_snapshot<lf_hash_map>("lockfree::lf_hash_map",iters);
+        return 0;
+    }
+
+    // ./test <threads> consistent - writers during point-in-time scan
+    if (argc_ > 2 && std::string(argv_[2]) == "consistent")
+    {
+        std::cout << "CONSISTENT SCAN TEST" << std::endl;
+        time_map_consistent<lf_hash_map>("lockfree::lf_hash_map",iters/10);
+        return 0;
+    }
+
+    // ./test <threads> delta - checkpoint of changed regions
+    if (argc_ > 2 && std::string(argv_[2]) == "delta")
+    {
+        std::cout << "DELTA TEST" << std::endl;
+        time_map_delta<lf_hash_map_dirty>("lockfree::lf_hash_map_dirty",iters);
+        return 0;
+    }
+
+    // ./test <threads> persist - restart of map, which lives in files
+    if (argc_ > 2 && std::string(argv_[2]) == "persist")
+    {
+        std::cout << "PERSIST TEST" << std::endl;
+        time_map_persist<lf_hash_map>("lockfree::lf_hash_map",iters);
+        return 0;
+    }
+
+    // ./test <processes> shared - one map for several processes
+    if (argc_ > 2 && std::string(argv_[2]) == "shared")
+    {
+        std::cout << "SHARED MEMORY TEST" << std::endl;
+        time_map_shared<lf_hash_map_shared>("lockfree::lf_hash_map_shared",iters);
+        return 0;
+    }
+
+    // ./test <threads> frozen - read-only copy of map
+    if (argc_ > 2 && std::string(argv_[2]) == "frozen")
+    {
+        std::cout << "FROZEN TEST" << std::endl;
+        time_map_frozen<lf_hash_map>("lockfree::lf_hash_map",iters);
+        return 0;
+    }
+
+    // ./test <threads> shrink - memory after mass delete
+    if (argc_ > 2 && std::string(argv_[2]) == "shrink")
+    {
+        std::cout << "SHRINK TEST" << std::endl;
+        time_map_shrink<lf_hash_map>("lockfree::lf_hash_map",iters);
+        return 0;
+    }
+
     std::cout << "START WARM UP SYSTEM BEFORE EXECUTING TEST" << std::endl;
     for (size_t i = 0; i != 2; ++i)
     {
@@ -554,6 +1623,8 @@ int main(int argc_,char **argv_)
         std::cout << "LOCK FREE CONCURRENCY TEST WITH " << nThreads << " THREADS" << std::endl;
 
         measure_mt_map<lf_hash_map,lock_free_test>("lockfree::lf_hash_map");
+        measure_mt_map<lf_hash_map_group,lock_free_test>("lockfree::lf_hash_map_group");
+        measure_mt_map<segmented_hash_map,lock_free_test>("lockfree::segmented_hash_map");
     }
 
     if (1)
@@ -564,6 +1635,14 @@ int main(int argc_,char **argv_)
         measure_st_map<lf_hash_map,0>("lockfree::lf_hash_map",1,iters);
     }
 
+    if (1)
+    {
+        std::cout << std::endl;
+        std::cout << "SINGLE THREAD LOCK FREE TEST (GROUP PROBING)" << std::endl;
+
+        measure_st_map<lf_hash_map_group,0>("lockfree::lf_hash_map_group",1,iters);
+    }
+
     if (1)
     {
         std::cout << std::endl;